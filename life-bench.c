@@ -0,0 +1,318 @@
+/**
+ * @file life-bench.c
+ *
+ * Набор тестов производительности. Драйвер работает как неинтерактивный
+ * клиент: для каждого сочетания размеров "вселенной", числа рабочих и
+ * нагрузки он запускает "life-server", загружает образец командой
+ * O_LOAD, строит заданное число поколений и дожидается их командой
+ * O_WAIT. Результаты (поколения в секунду, клетки в секунду, время
+ * загрузки, вычислений и синхронизации) печатаются в формате CSV или
+ * JSON. Случайные образцы строятся собственным генератором с
+ * фиксированным зерном, поэтому результаты сравнимы между коммитами.
+ * Поиск циклов сервер выключает ("-c 0"), иначе устоявшиеся нагрузки
+ * пропускали бы периоды вместо вычислений; замерить пропуск периодов
+ * можно, передав "-c" в ключах сервера.
+ *
+ * Запуск:
+ *   ./life-bench [-s MxN,...] [-k K,...] [-w нагрузка,...] [-n поколения]
+ *                [-f csv|json] [-t метка] [-- ключи сервера]
+ *
+ * Нагрузки: soup10, soup30, soup50 (случайные образцы плотности 10, 30 и
+ * 50%), gosper (ружье Госпера), rpent (R-пентамино), empty (пустая
+ * "вселенная").
+ */
+
+#include "life.h"
+#include "life-ring.h"
+#include "life-msg.h"
+
+/** @brief последний ответ сервера */
+struct life_msg reply;
+/** @brief идентификатор процесса-сервера */
+pid_t pid_server = 0;
+/** @brief идентификатор процесса-драйвера */
+pid_t pid_client = 0;
+/** @brief идентификатор очереди сообщений */
+int   msgid = 0;
+
+/** @brief наибольшее число значений в одном списке параметров */
+#define BENCH_LIST 32
+
+/** @brief ружье Госпера в формате RLE */
+static const char *bench_gosper =
+    "x = 36, y = 9, rule = B3/S23\n"
+    "24bo$22bobo$12b2o6b2o12b2o$11bo3bo4b2o12b2o$2o8bo5bo3b2o$2o8bo3bob2o4b\n"
+    "obo$10bo5bo7bo$11bo3bo$12b2o!\n";
+/** @brief R-пентамино в формате RLE */
+static const char *bench_rpent =
+    "x = 3, y = 3, rule = B3/S23\n"
+    "b2o$2o$bo!\n";
+
+/** @brief результат одного замера */
+struct bench_result {
+    /** @brief время загрузки образца, с */
+    double seed;
+    /** @brief время построения поколений, с */
+    double total;
+    /** @brief наибольшее время вычислений одного рабочего, с */
+    double compute;
+};
+
+/**
+ * Отправить команду серверу и дождаться ответа.
+ *
+ * @param[in] op тип операции
+ * @param[in] p1 первый параметр операции
+ * @param[in] p2 второй параметр операции
+ * @param[in] text текст команды (путь к файлу) или NULL
+ * @return 0, если сервер ответил "OK", иначе -1
+ */
+int bench_command(int op, int p1, int p2, const char *text) {
+    msg_send(msgid, pid_server, op, p1, p2, 0, text, (text) ? strlen(text): 0);
+    if (msg_recv(msgid, pid_client, &reply, 0) == -1) return -1;
+    return (strncmp(reply.data, "OK", 2) == 0) ? 0: -1;
+}
+
+/**
+ * Текущее время в секундах.
+ *
+ * @return значение монотонных часов
+ */
+double bench_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * Записать образец нагрузки во временный файл.
+ *
+ * @param[in] workload имя нагрузки
+ * @param[in] M число клеток "вселенной" по вертикали
+ * @param[in] N число клеток "вселенной" по горизонтали
+ * @param[out] path путь к созданному файлу
+ * @param[out] x номер строки, в которую ставится образец
+ * @param[out] y номер столбца, в который ставится образец
+ * @return 1, если образец записан, 0 для пустой "вселенной", -1, если
+ * нагрузка неизвестна или не помещается во "вселенную"
+ */
+int bench_pattern(const char *workload, int M, int N, char *path, int *x, int *y) {
+    const char *rle = NULL;
+    int density = 0, w = 0, h = 0;
+
+    if (strcmp(workload, "empty") == 0) return 0;
+    if (strcmp(workload, "gosper") == 0) {
+        rle = bench_gosper; w = 36; h = 9;
+    } else if (strcmp(workload, "rpent") == 0) {
+        rle = bench_rpent; w = 3; h = 3;
+    } else if (sscanf(workload, "soup%d", &density) != 1 || density < 0 || density > 100) {
+        return -1;
+    }
+    if (w > N || h > M) return -1;
+
+    strcpy(path, "/tmp/life-bench-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd == -1) return -1;
+    FILE *f = fdopen(fd, "w");
+
+    if (rle) {
+        fputs(rle, f);
+        *x = (M - h) / 2 + 1;
+        *y = (N - w) / 2 + 1;
+    } else {
+        uint32_t seed = 12345;
+        for (int i = 0; i < M; i++) {
+            for (int j = 0; j < N; j++) {
+                seed = seed * 1103515245u + 12345u;
+                fputc((int) ((seed >> 16) % 100) < density ? 'O': '.', f);
+            }
+            fputc('\n', f);
+        }
+        *x = 1;
+        *y = 1;
+    }
+    fclose(f);
+    return 1;
+}
+
+/**
+ * Запустить сервер, загрузить нагрузку и построить поколения.
+ *
+ * @param[in] workload имя нагрузки
+ * @param[in] M число клеток "вселенной" по вертикали
+ * @param[in] N число клеток "вселенной" по горизонтали
+ * @param[in] K число рабочих
+ * @param[in] gens число поколений
+ * @param[in] argc число ключей сервера
+ * @param[in] argv ключи сервера (идут после "-c 0" и могут его заменить)
+ * @param[out] r результат замера
+ * @return 0 при успехе, -1 при ошибке
+ */
+int bench_run(const char *workload, int M, int N, int K, int gens,
+              int argc, char *argv[], struct bench_result *r) {
+    char path[64];
+    int x = 1, y = 1;
+    int seeded = bench_pattern(workload, M, N, path, &x, &y);
+    if (seeded == -1) return -1;
+
+    char arg1[25], arg2[25], arg3[25];
+    sprintf(arg1, "%d", M);
+    sprintf(arg2, "%d", N);
+    sprintf(arg3, "%d", K);
+    char *args[argc + 7];
+    args[0] = "./life-server";
+    args[1] = arg1;
+    args[2] = arg2;
+    args[3] = arg3;
+    args[4] = "-c";
+    args[5] = "0";
+    for (int i = 0; i < argc; i++) args[6+i] = argv[i];
+    args[6+argc] = NULL;
+
+    if (!(pid_server = fork())) {
+        execv("./life-server", args);
+        quit_message("ERROR: Failed to run the server.");
+    }
+
+    if (msg_recv(msgid, pid_client, &reply, 0) == -1 || strncmp(reply.data, "OK", 2) != 0) {
+        waitpid(pid_server, NULL, 0);
+        if (seeded) remove(path);
+        return -1;
+    }
+
+    struct life_ctl *ctl = shmat(shmget(ftok("server", 'c'), 0, 0666), NULL, SHM_RDONLY);
+    int workers = ctl->workers;
+    uint64_t busy[workers];
+
+    double t0 = bench_now();
+    if (seeded) {
+        bench_command(O_LOAD, x, y, path);
+        remove(path);
+    }
+    r->seed = bench_now() - t0;
+
+    for (int i = 0; i < workers; i++) busy[i] = ctl_ring(ctl, i)->busy;
+
+    t0 = bench_now();
+    bench_command(O_START, gens, 0, NULL);
+    bench_command(O_WAIT, 0, 0, NULL);
+    r->total = bench_now() - t0;
+
+    r->compute = 0;
+    for (int i = 0; i < workers; i++) {
+        double c = (ctl_ring(ctl, i)->busy - busy[i]) * 1e-9;
+        if (c > r->compute) r->compute = c;
+    }
+
+    shmdt(ctl);
+    bench_command(O_QUIT, 0, 0, NULL);
+    waitpid(pid_server, NULL, 0);
+    return 0;
+}
+
+/**
+ * Разобрать список значений, разделенных запятыми.
+ *
+ * @param[in] s строка со списком
+ * @param[out] item элементы списка (указатели внутрь s)
+ * @return число элементов
+ */
+int bench_split(char *s, char *item[]) {
+    int n = 0;
+    for (char *t = strtok(s, ","); t && n < BENCH_LIST; t = strtok(NULL, ",")) item[n++] = t;
+    return n;
+}
+
+/**
+ * Основная функция драйвера: разбирает ключи, перебирает все сочетания
+ * размеров, числа рабочих и нагрузок и печатает результаты.
+ */
+int main(int argc, char *argv[]) {
+    char sizes_arg[STRSIZE] = "256x256,1024x1024";
+    char workers_arg[STRSIZE] = "1,2,4";
+    char loads_arg[STRSIZE] = "soup10,soup30,soup50,gosper,rpent,empty";
+    char *format = "csv", *tag = "";
+    int gens = 200, i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (i+1 >= argc) quit_message("ERROR: Wrong benchmark options.");
+
+        if (strcmp(argv[i], "-s") == 0) {
+            snprintf(sizes_arg, STRSIZE, "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            snprintf(workers_arg, STRSIZE, "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0) {
+            snprintf(loads_arg, STRSIZE, "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            gens = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0) {
+            format = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0) {
+            tag = argv[++i];
+        } else quit_message("ERROR: Wrong benchmark options.");
+    }
+    if (gens < 1) quit_message("ERROR: The number of generation should be postive one.");
+    int json = strcmp(format, "json") == 0;
+
+    char opts[STRSIZE] = "";
+    for (int j = i, len = 0; j < argc && len < STRSIZE - 1; j++)
+        len += snprintf(opts + len, STRSIZE - len, (j > i) ? " %s": "%s", argv[j]);
+
+    char *sizes[BENCH_LIST], *workers[BENCH_LIST], *loads[BENCH_LIST];
+    int ns = bench_split(sizes_arg, sizes);
+    int nk = bench_split(workers_arg, workers);
+    int nw = bench_split(loads_arg, loads);
+
+    pid_client = getpid();
+    int fd = open("server", O_CREAT, 0666); close(fd);
+    msgid = msgget(ftok("server", 's'), 0666 | IPC_CREAT);
+
+    if (json) {
+        printf("[\n");
+    } else printf("tag,workload,M,N,K,options,generations,seconds,gens_per_sec,"
+                  "cells_per_sec,seed_ms,compute_ms,sync_ms\n");
+
+    int first = 1;
+    for (int a = 0; a < ns; a++) {
+        int M, N;
+        if (sscanf(sizes[a], "%dx%d", &M, &N) != 2 || M < 1 || N < 1) continue;
+
+        for (int b = 0; b < nk; b++) {
+            int K = atoi(workers[b]);
+            if (K < 1) continue;
+
+            for (int c = 0; c < nw; c++) {
+                struct bench_result r;
+                if (bench_run(loads[c], M, N, K, gens, argc - i, argv + i, &r) == -1) {
+                    fprintf(stderr, "%s %dx%d K=%d: skipped\n", loads[c], M, N, K);
+                    continue;
+                }
+
+                double gps = gens / r.total;
+                double cps = gps * M * N;
+                double sync = (r.total > r.compute) ? r.total - r.compute: 0;
+                if (json) {
+                    printf("%s  {\"tag\": \"%s\", \"workload\": \"%s\", \"M\": %d, \"N\": %d, "
+                           "\"K\": %d, \"options\": \"%s\", \"generations\": %d, "
+                           "\"seconds\": %.6f, \"gens_per_sec\": %.2f, \"cells_per_sec\": %.0f, "
+                           "\"seed_ms\": %.3f, \"compute_ms\": %.3f, \"sync_ms\": %.3f}",
+                           first ? "": ",\n", tag, loads[c], M, N, K, opts, gens,
+                           r.total, gps, cps, r.seed * 1e3, r.compute * 1e3, sync * 1e3);
+                } else printf("%s,%s,%d,%d,%d,%s,%d,%.6f,%.2f,%.0f,%.3f,%.3f,%.3f\n",
+                              tag, loads[c], M, N, K, opts, gens, r.total, gps, cps,
+                              r.seed * 1e3, r.compute * 1e3, sync * 1e3);
+                fflush(stdout);
+                first = 0;
+            }
+        }
+    }
+    if (json) printf("\n]\n");
+
+    msgctl(msgid, IPC_RMID, NULL);
+    remove("server");
+    return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file life-chunk.h
+ *
+ * Разреженная неограниченная "вселенная" (ключ сервера "-e sparse").
+ * Плоскость делится на чанки CHUNK_SIZE x CHUNK_SIZE упакованных клеток,
+ * и хранятся только чанки, в которых есть живые клетки или рядом с
+ * которыми они могут появиться. Чанк принадлежит рабочему, номер
+ * которого получается хешированием координат группы CHUNK_GROUP x
+ * CHUNK_GROUP чанков, в которую он входит.
+ *
+ * Сервер создает сегмент разделяемой памяти: за заголовком struct
+ * life_chunks лежат K частей struct chunk_part, по одной на рабочего.
+ * Часть содержит чанки рабочего (у каждого два буфера: текущее и новое
+ * поколение), хеш-таблицу для поиска чанка по координатам и почтовый
+ * ящик заявок на чанки, которые нужны соседям. Поколение строится в два
+ * этапа, разделенных барьером сервера:
+ *   -# O_GROW: рабочий делает новые буферы своих чанков текущими,
+ * выделяет чанки по заявкам и освобождает пустые чанки, на которые
+ * заявок нет, после чего перестраивает хеш-таблицу;
+ *   -# O_START: рабочий строит новое поколение своих чанков, читая
+ * текущие буферы соседних чанков (в том числе чужих), и отправляет
+ * заявки на соседние чанки, к краям которых подошли живые клетки.
+ * Хеш-таблицы и текущие буферы меняет только владелец и только на
+ * первом этапе, когда их никто не читает.
+ */
+
+#ifndef LIFE_CHUNK_H
+#define LIFE_CHUNK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** @brief сторона чанка в клетках (одна строка — одно слово) */
+#define CHUNK_SIZE 64
+/** @brief сторона группы чанков с одним владельцем */
+#define CHUNK_GROUP 4
+/** @brief наибольшее число чанков одного рабочего */
+#define CHUNK_CAPACITY 4096
+/** @brief размер хеш-таблицы чанков рабочего (степень двойки) */
+#define CHUNK_TABLE (2 * CHUNK_CAPACITY)
+/** @brief размер почтового ящика заявок рабочего */
+#define CHUNK_INBOX (8 * CHUNK_CAPACITY)
+
+/** @brief чанк */
+struct chunk {
+    /** @brief номер чанка по вертикали: строки cx*CHUNK_SIZE.. */
+    int32_t cx;
+    /** @brief номер чанка по горизонтали */
+    int32_t cy;
+    /** @brief чанк занят */
+    int32_t used;
+    /** @brief на чанк есть заявка (используется только владельцем) */
+    int32_t wanted;
+    /** @brief два буфера по CHUNK_SIZE строк; текущий указан в
+     * struct chunk_part */
+    uint64_t row[2][CHUNK_SIZE];
+};
+
+/** @brief заявка на чанк */
+struct chunk_request {
+    /** @brief номер чанка по вертикали */
+    int32_t cx;
+    /** @brief номер чанка по горизонтали */
+    int32_t cy;
+};
+
+/** @brief часть сегмента, принадлежащая одному рабочему */
+struct chunk_part {
+    /** @brief номер текущего буфера всех чанков рабочего */
+    uint32_t cur;
+    /** @brief число заявок в почтовом ящике (увеличивается атомарно) */
+    uint32_t count;
+    /** @brief места для чанков или заявок не хватило */
+    int32_t overflow;
+    /** @brief хеш-таблица: номер места чанка плюс один, 0 — пусто */
+    int32_t table[CHUNK_TABLE];
+    /** @brief почтовый ящик заявок */
+    struct chunk_request inbox[CHUNK_INBOX];
+    /** @brief места для чанков */
+    struct chunk chunk[CHUNK_CAPACITY];
+};
+
+/** @brief заголовок сегмента чанков */
+struct life_chunks {
+    /** @brief число рабочих */
+    int workers;
+};
+
+/**
+ * Размер сегмента чанков. Страницы сегмента заполняются по мере
+ * занятия мест, поэтому память растет с числом живых чанков.
+ *
+ * @param[in] workers число рабочих
+ * @return размер в байтах
+ */
+static inline size_t chunks_size(int workers) {
+    return sizeof(struct chunk_part) * (size_t) (workers + 1);
+}
+
+/**
+ * Часть рабочего (выровнена по размеру struct chunk_part).
+ *
+ * @param[in] c сегмент чанков
+ * @param[in] i номер рабочего
+ * @return часть рабочего
+ */
+static inline struct chunk_part *chunks_part(struct life_chunks *c, int i) {
+    return (struct chunk_part *) ((char *) c + sizeof(struct chunk_part) * (size_t) (i + 1));
+}
+
+/**
+ * Номер чанка, в который попадает строка или столбец (с округлением
+ * вниз для отрицательных номеров).
+ *
+ * @param[in] v номер строки или столбца, с нуля
+ * @return номер чанка
+ */
+static inline int chunk_index(int v) {
+    return (v >= 0) ? v / CHUNK_SIZE: -((-v - 1) / CHUNK_SIZE) - 1;
+}
+
+/**
+ * Хеш координат.
+ */
+static inline uint32_t chunk_hash(int cx, int cy) {
+    uint64_t k = ((uint64_t) (uint32_t) cx << 32 | (uint32_t) cy) * 0x9e3779b97f4a7c15ull;
+    return (uint32_t) (k >> 32);
+}
+
+/**
+ * Владелец чанка.
+ *
+ * @param[in] cx номер чанка по вертикали
+ * @param[in] cy номер чанка по горизонтали
+ * @param[in] workers число рабочих
+ * @return номер рабочего
+ */
+static inline int chunk_owner(int cx, int cy, int workers) {
+    int gx = (cx >= 0) ? cx / CHUNK_GROUP: -((-cx - 1) / CHUNK_GROUP) - 1;
+    int gy = (cy >= 0) ? cy / CHUNK_GROUP: -((-cy - 1) / CHUNK_GROUP) - 1;
+    return chunk_hash(gx, gy) % workers;
+}
+
+/**
+ * Найти чанк в хеш-таблице части.
+ *
+ * @param[in] p часть владельца чанка
+ * @param[in] cx номер чанка по вертикали
+ * @param[in] cy номер чанка по горизонтали
+ * @return чанк или NULL
+ */
+static inline struct chunk *chunk_find(struct chunk_part *p, int cx, int cy) {
+    for (uint32_t h = chunk_hash(cx, cy) & (CHUNK_TABLE-1); p->table[h]; h = (h+1) & (CHUNK_TABLE-1)) {
+        struct chunk *c = &p->chunk[p->table[h] - 1];
+        if (c->cx == cx && c->cy == cy) return c;
+    }
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * @file life-ckpt.h
+ *
+ * Двоичный формат контрольной точки "вселенной". Файл состоит из
+ * заголовка struct ckpt_header и rows упакованных строк по words слов
+ * uint64_t; клетка j строки хранится в бите j % 64 слова j / 64, как и в
+ * упакованном ядре. Формат не зависит от числа рабочих: каждый рабочий
+ * записывает и читает свой блок по его смещению во "вселенной", поэтому
+ * контрольную точку можно восстановить при другом K.
+ */
+
+#ifndef LIFE_CKPT_H
+#define LIFE_CKPT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** @brief сигнатура файла контрольной точки */
+#define CKPT_MAGIC   "PLIFECK1"
+/** @brief версия формата */
+#define CKPT_VERSION 1
+
+/** @brief заголовок контрольной точки (64 байта) */
+struct ckpt_header {
+    /** @brief сигнатура CKPT_MAGIC */
+    char magic[8];
+    /** @brief версия формата */
+    uint32_t version;
+    /** @brief число клеток "вселенной" по вертикали */
+    int32_t rows;
+    /** @brief число клеток "вселенной" по горизонтали */
+    int32_t cols;
+    /** @brief число слов uint64_t в строке */
+    int32_t words;
+    /** @brief номер сохраненного поколения */
+    int64_t generation;
+    /** @brief правило в записи B/S, восстанавливается вместе с
+     * "вселенной" */
+    char rule[32];
+};
+
+/**
+ * Число слов uint64_t в строке контрольной точки.
+ *
+ * @param[in] cols число клеток в строке
+ * @return число слов
+ */
+static inline int ckpt_words(int cols) {
+    return (cols + 63) / 64;
+}
+
+/**
+ * Размер файла контрольной точки.
+ *
+ * @param[in] rows число клеток по вертикали
+ * @param[in] cols число клеток по горизонтали
+ * @return размер в байтах
+ */
+static inline size_t ckpt_size(int rows, int cols) {
+    return sizeof(struct ckpt_header) + (size_t) rows * ckpt_words(cols) * sizeof(uint64_t);
+}
+
+/**
+ * Упакованная строка отображенного в память файла.
+ *
+ * @param[in] base начало отображения
+ * @param[in] x номер строки, начиная с 0
+ * @return указатель на первое слово строки
+ */
+static inline uint64_t *ckpt_row(void *base, int x) {
+    struct ckpt_header *h = (struct ckpt_header *) base;
+    return (uint64_t *) (h + 1) + (size_t) x * h->words;
+}
+
+/**
+ * Прочитать 64 клетки упакованной строки, начиная с клетки pos. Клетки
+ * за пределами строки считаются мертвыми.
+ *
+ * @param[in] src упакованная строка
+ * @param[in] words число слов в строке
+ * @param[in] pos номер первой клетки
+ * @return слово, в бите k которого лежит клетка pos+k
+ */
+static inline uint64_t ckpt_get_bits(const uint64_t *src, int words, int pos) {
+    int w = pos / 64, s = pos % 64;
+    uint64_t v = (w < words) ? src[w] >> s: 0;
+    if (s && w+1 < words) v |= src[w+1] << (64 - s);
+    return v;
+}
+
+/**
+ * Атомарно добавить живые клетки слова v в строку, начиная с клетки
+ * pos. Соседние блоки могут делить слово файла, поэтому запись идет
+ * через атомарное ИЛИ.
+ *
+ * @param[in,out] dst упакованная строка
+ * @param[in] pos номер клетки, соответствующей биту 0 слова v
+ * @param[in] v клетки
+ */
+static inline void ckpt_or_bits(uint64_t *dst, int pos, uint64_t v) {
+    int w = pos / 64, s = pos % 64;
+    if (v << s) __atomic_fetch_or(&dst[w], v << s, __ATOMIC_RELAXED);
+    if (s && (v >> (64 - s))) __atomic_fetch_or(&dst[w+1], v >> (64 - s), __ATOMIC_RELAXED);
+}
+
+#endif
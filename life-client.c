@@ -4,10 +4,25 @@
  * Клиент принимает команды со стандартного потока ввода и пердает эти
  * команды в понятном для сервера виде. Все типы операций описаны в
  * заголовочном файле "life.h".
+ *
+ * В пакетном режиме (ключ "-f сценарий" или "--pipeline" для
+ * стандартного потока ввода) клиент не ждет ответа на каждую команду:
+ * до PIPELINE_WINDOW команд могут быть отправлены без ответа, а подряд
+ * идущие команды add и del отправляются пачками O_CELLS. Сервер
+ * выполняет команды по порядку и отвечает на них в том же порядке, а
+ * клиент сопоставляет ответы командам по номеру seq. Команды, после
+ * которых клиент читает разделяемую память или ждет сервер (snapshot,
+ * stats, wait, sleep, quit), дожидаются ответов на все отправленные
+ * команды.
  */
 
 #include "life.h"
-
+#include "life-fb.h"
+#include "life-ring.h"
+#include "life-msg.h"
+
+/** @brief последний ответ сервера */
+struct life_msg reply;
 /** @brief идентификатор процесса-сервера */
 pid_t pid_server = 0;
 /** @brief идентификатор процесса-клиента */
@@ -16,15 +31,60 @@ pid_t pid_client = 0;
 key_t key = 0;
 /** @brief идентификатор очереди сообщений */
 int   msgid = 0;
-
+/** @brief кадр "вселенной", в который сервер складывает скриншоты */
+struct life_fb *fb = NULL;
+/** @brief управляющий сегмент, из которого читаются счетчики этапов */
+struct life_ctl *ctl = NULL;
+
+/** @brief наибольшее число команд без ответа в пакетном режиме */
+#define PIPELINE_WINDOW 64
+/** @brief размер очереди сообщений, который клиент пытается получить
+ * для пакетного режима */
+#define PIPELINE_BYTES (64 * 1024)
+
+/** @brief команда, отправленная серверу и ждущая ответа */
+struct client_request {
+    /** @brief номер команды */
+    int seq;
+    /** @brief тип операции */
+    int op;
+    /** @brief второй параметр операции */
+    int prm2;
+    /** @brief сколько байтов очереди могут занять команда и ответ */
+    size_t bytes;
+};
+
+/** @brief отправленные команды без ответа (кольцо по номеру команды) */
+struct client_request pending[PIPELINE_WINDOW];
+/** @brief пакетный режим */
+int   pipeline = 0;
+/** @brief сколько байтов очереди могут занять команды без ответа и
+ * ответы на них */
+size_t budget = 0;
+/** @brief число отправленных команд без ответа */
+int   inflight = 0;
+/** @brief сколько байтов очереди могут занять команды без ответа */
+size_t inflight_bytes = 0;
+/** @brief номер следующей команды */
+int   seq_next = 1;
+/** @brief накопленная пачка клеток */
+struct msg_cell batch[MSG_CELLS];
+/** @brief число клеток в пачке */
+int   batch_count = 0;
+/** @brief наибольшее число клеток в пачке (0 — клетки отправляются по
+ * одной) */
+int   batch_max = 0;
+
 /**
  * Клиент завершает свою работу
- */
-void quit_client(void) {
+ */
+void quit_client(void) {
+    if (fb) shmdt(fb);
+    if (ctl) shmdt(ctl);
     while (wait(NULL) > 0);
     msgctl(msgid, IPC_RMID, 0);
-    remove("server");
-}
+    remove("server");
+}
 
 /**
  * Функция обработчик. Обрабатывает приход сигнала SIGTERM,
@@ -36,44 +96,27 @@ void handler(int signo) {
     kill(pid_server, SIGTERM);
     quit_client();
     exit(1);
-}
+}
 
 /**
- * Проверка на правильность разбиения.
+ * Проверка на правильность разбиения. "Вселенная" делится сервером на
+ * блоки, поэтому рабочих не может быть больше, чем клеток.
  *
+ * @param[in] M число клеток "вселенной" по вертикали
  * @param[in] N число клеток "вселенной" по горизонтали
  * @param[in] K чило процессов-рабочих
  *
  * @return Новое число процессов-рабочих, если разбиение невозможно,
  * иначе - старое число рабочих.
  */
-int client_check_partition(int N, int K) {
-    char flag = 0;
-
-    if (K > N) {
+int client_check_partition(int M, int N, int K) {
+    if ((long long) M * N < K) {
         printf("ERROR: You want to create too many processes.\n");
-        printf("The number of processes was set as %d.\n", N);
-        return N;
-    }
-
-    do {
-        int width = (N % K) ? N/K + 1: N/K;
-        if (width * (K-1) <= N) break;
-        flag = 1;
-        K--;
-    } while (K > 0);
-
-    if (flag) {
-        printf("ERORR: Such partition is not available.\n");
-        if (K > 0) {
-            printf("The number of processes was set as %d.\n", K);
-        } else {
-            printf("The number of processes was set as %d.\n", N);
-            return N;
-        }
+        printf("The number of processes was set as %d.\n", M*N);
+        return M*N;
     }
     return K;
-}
+}
 
 /**
  * Отправить сообщение серверу.
@@ -81,40 +124,222 @@ int client_check_partition(int N, int K) {
  * @param[in] op тип операции
  * @param[in] p1 первый параметр операции (опционально)
  * @param[in] p2 второй параметр операции (опционально)
+ * @param[in] data содержимое (путь к файлу, правило, пачка клеток)
+ * @param[in] len длина содержимого
  * @return При успешном завершении возвращает 0, а при ошибке — -1, и в
  * переменную errno записывается код ошибки.
  */
-int snd_server_message(int op, int p1, int p2) {
-    message.mtype = pid_server;
-    message.op    = op;
-    message.prm1  = p1;
-    message.prm2  = p2;
-    return msgsnd(msgid, (struct msgbuf*)(&message), sizeof(message), 0);
+int snd_server_message(int op, int p1, int p2, const void *data, uint32_t len) {
+    return msg_send(msgid, pid_server, op, p1, p2, seq_next, data, len);
 }
 
 /**
- * Принять сообщение от сервера.
+ * Принять ответ сервера в reply и напечатать его.
  *
  * @param[in] c включает флаг IPC_NOWAIT
- * @return При успешном завершении системный вызов возвращает
- * действительную длину сообщения, скопированного в поле mtext. При
- * ошибке возвращается -1, а в переменную errno записывается код ошибки.
+ * @return При успешном завершении возвращает 0, а при ошибке — -1, и в
+ * переменную errno записывается код ошибки.
  */
-ssize_t rcv_server_message(char c) {
-    ssize_t p = msgrcv(msgid, (struct msgbuf*)(&message), sizeof(message), pid_client, c*IPC_NOWAIT);
-    if (p) printf("%s\n", message.mtext);
+int rcv_server_message(char c) {
+    int p = msg_recv(msgid, pid_client, &reply, c);
+    if (p == 0) printf("%s\n", reply.data);
     return p;
 }
 
+/**
+ * Напечатать скриншот из буфера кадра, номер которого сервер прислал в
+ * ответе на команду O_SNAP. Строки читаются напрямую из разделяемой
+ * памяти.
+ */
+void client_print_snapshot(void) {
+    int b = reply.prm1;
+    for (int i = 0; i < fb->rows; i++) {
+        fwrite(fb_row(fb, b, i), 1, fb->cols, stdout);
+        putchar('\n');
+    }
+}
+
+/**
+ * Напечатать изменения с прошлого скриншота: по отрезку изменившихся
+ * клеток в строке "строка столбец клетки" (нумерация с единицы, как в
+ * команде add). Новые состояния клеток читаются из буфера кадра, номер
+ * которого сервер прислал в ответе на команду O_SNAP.
+ */
+void client_print_delta(void) {
+    int b = reply.prm1;
+    for (int i = 0; i < fb->workers; i++) {
+        const struct fb_delta *d = fb_delta(fb, i);
+        for (int r = 0; r < d->count; r++) {
+            const struct fb_run *run = &d->run[r];
+            printf("%d %d ", run->row + 1, run->col + 1);
+            fwrite(fb_row(fb, b, run->row) + run->col, 1, run->len, stdout);
+            putchar('\n');
+        }
+    }
+}
+
+/**
+ * Напечатать строку таблицы счетчиков: число замеров, медиану, 99-й
+ * процентиль и среднее время этапа в микросекундах.
+ *
+ * @param[in] name название этапа
+ * @param[in] h гистограмма этапа
+ */
+void client_print_phase(const char *name, const struct stats_hist *h) {
+    uint64_t count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+    printf("  %-10s %10llu %12.1f %12.1f %12.1f\n", name, (unsigned long long) count,
+           stats_percentile(h, 0.5) / 1e3, stats_percentile(h, 0.99) / 1e3,
+           (count) ? h->total / 1e3 / count: 0.0);
+}
+
+/**
+ * Напечатать счетчики этапов сервера и рабочих, которые сервер и
+ * рабочие ведут в управляющем сегменте, вместе с числом построенных
+ * поколений и живых клеток, а также периодом найденного цикла и числом
+ * пропущенных благодаря циклам поколений.
+ */
+void client_print_stats(void) {
+    static const char *server_phase[] = {"dispatch", "acks", "batch", "client"};
+    static const char *worker_phase[] = {"halo", "swap", "compute", "sync", "border"};
+    struct life_stats *st = ctl_stats(ctl, ctl->workers);
+
+    printf("  %-10s %10s %12s %12s %12s\n", "phase", "count", "p50, us", "p99, us", "mean, us");
+    printf("server: generations %lld, live cells %lld",
+           (long long) st->generations, (long long) st->live);
+    if (st->period) printf(", cycle period %lld", (long long) st->period);
+    if (st->skipped) printf(", skipped generations %lld", (long long) st->skipped);
+    printf("\n");
+    for (int p = ST_DISPATCH; p <= ST_CLIENT; p++) client_print_phase(server_phase[p], &st->phase[p]);
+
+    for (int i = 0; i < ctl->workers; i++) {
+        st = ctl_stats(ctl, i);
+        printf("worker %d: generations %lld, live cells %lld\n", i,
+               (long long) st->generations, (long long) st->live);
+        for (int p = ST_HALO; p <= ST_BORDER; p++) client_print_phase(worker_phase[p], &st->phase[p]);
+    }
+}
+
+/**
+ * Принять ответ на самую раннюю из отправленных команд и напечатать
+ * его, а для snapshot и stats — еще и скриншот или счетчики.
+ */
+void client_collect(void) {
+    struct client_request *r = &pending[(seq_next - inflight) % PIPELINE_WINDOW];
+
+    int p = rcv_server_message(0);
+    inflight--;
+    inflight_bytes -= r->bytes;
+    if (p == -1) return;
+    if (reply.seq != r->seq) {
+        printf("ERROR: Reply to command %d came instead of command %d.\n", reply.seq, r->seq);
+        return;
+    }
+
+    if (r->op == O_SNAP) {
+        if (r->prm2 && strcmp(reply.data, "OK full") != 0) {
+            client_print_delta();
+        } else client_print_snapshot();
+    } else if (r->op == O_STATS) client_print_stats();
+}
+
+/**
+ * Дождаться ответов на все отправленные команды.
+ */
+void client_drain(void) {
+    while (inflight > 0) client_collect();
+}
+
+/**
+ * Отправить команду серверу. В пакетном режиме клиент сначала принимает
+ * ответы на самые ранние команды, пока новая команда и ответ на нее не
+ * поместятся в очередь вместе с уже отправленными; иначе он дожидается
+ * ответа сразу. Ответы печатает client_collect().
+ *
+ * @param[in] op тип операции
+ * @param[in] p1 первый параметр операции
+ * @param[in] p2 второй параметр операции
+ * @param[in] data содержимое
+ * @param[in] len длина содержимого
+ */
+void client_request(int op, int p1, int p2, const void *data, uint32_t len) {
+    size_t bytes = msg_bytes(len) + msg_bytes((op == O_CELLS) ? p1 * MSG_LINE: MSG_REPLY);
+    while (inflight > 0 && (inflight == PIPELINE_WINDOW || inflight_bytes + bytes > budget))
+        client_collect();
+
+    struct client_request *r = &pending[seq_next % PIPELINE_WINDOW];
+    r->seq   = seq_next;
+    r->op    = op;
+    r->prm2  = p2;
+    r->bytes = bytes;
+
+    snd_server_message(op, p1, p2, data, len);
+    seq_next++;
+    inflight++;
+    inflight_bytes += bytes;
+    if (!pipeline) client_drain();
+}
+
+/**
+ * Отправить накопленную пачку клеток.
+ */
+void client_flush_cells(void) {
+    if (!batch_count) return;
+    client_request(O_CELLS, batch_count, 0, batch, batch_count * sizeof(struct msg_cell));
+    batch_count = 0;
+}
+
+/**
+ * Добавить или удалить клетку: в пакетном режиме клетка попадает в
+ * пачку, иначе сразу отправляется команда O_ADD или O_DEL.
+ *
+ * @param[in] x номер строки
+ * @param[in] y номер столбца
+ * @param[in] alive 1 — добавить клетку, 0 — удалить
+ */
+void client_cell(int x, int y, int alive) {
+    if (!batch_max) {
+        client_request((alive) ? O_ADD: O_DEL, x, y, NULL, 0);
+        return;
+    }
+    batch[batch_count++] = (struct msg_cell) {x, y, alive};
+    if (batch_count == batch_max) client_flush_cells();
+}
+
+/**
+ * Подготовить пакетный режим. Команды и ответы лежат в одной очереди
+ * сообщений, и, чтобы ни клиент, ни сервер не заблокировались на
+ * переполненной очереди, команды без ответа вместе с ответами на них
+ * должны в ней помещаться. Клиент пытается увеличить очередь до
+ * PIPELINE_BYTES, а размер пачки клеток выбирает так, чтобы пачка и
+ * ответ на нее поместились в очередь.
+ */
+void client_pipeline_setup(void) {
+    struct msqid_ds q;
+    if (msgctl(msgid, IPC_STAT, &q) == -1) return;
+    if (q.msg_qbytes < PIPELINE_BYTES) {
+        q.msg_qbytes = PIPELINE_BYTES;
+        msgctl(msgid, IPC_SET, &q);
+        msgctl(msgid, IPC_STAT, &q);
+    }
+
+    pipeline = 1;
+    budget = q.msg_qbytes;
+    for (batch_max = MSG_CELLS; batch_max > 1; batch_max--) {
+        if (msg_bytes(batch_max * sizeof(struct msg_cell)) + msg_bytes(batch_max * MSG_LINE) <= budget) break;
+    }
+}
+
 /**
  * Основная функция клиента. Здесь
- *   -# производится чтение параметров N, M, K из командной строки,
+ *   -# производится чтение параметров N, M, K из командной строки и
+ * ключей пакетного режима "-f сценарий" и "--pipeline" (остальные ключи
+ * передаются серверу без изменений),
  *   -# проверяется частичная корректность входных параметров,
  *   -# включает аппарат очереди сообщений IPC,
  *   -# включает сервер и осуществляет обмен данных с сервером.
  */
 int main(int argc, char *argv[]) {
-    if (argc != 4)
+    if (argc < 4)
         quit_message("ERROR: Wrong number of parameters.");
 
     int N, M, K;
@@ -125,7 +350,19 @@ int main(int argc, char *argv[]) {
     if (!(N > 0 && M > 0 && K > 0))
         quit_message("ERROR: Parameters should be positive.");
 
-    K = client_check_partition(N, K);
+    K = client_check_partition(M, N, K);
+
+    int script = 0, argn = 4;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--pipeline") == 0) {
+            script = 1;
+        } else if (strcmp(argv[i], "-f") == 0 && i+1 < argc) {
+            if (!freopen(argv[++i], "r", stdin))
+                quit_message("ERROR: Failed to open the script.");
+            script = 1;
+        } else argv[argn++] = argv[i];
+    }
+    argv[argn] = NULL;
 
     pid_client = getpid();
 
@@ -141,64 +378,118 @@ int main(int argc, char *argv[]) {
         sprintf(arg1, "%d", M);
         sprintf(arg2, "%d", N);
         sprintf(arg3, "%d", K);
-        execlp("./life-server", "./life-server", arg1, arg2, arg3, NULL);
+        argv[0] = "./life-server";
+        argv[1] = arg1;
+        argv[2] = arg2;
+        argv[3] = arg3;
+        execvp("./life-server", argv);
         kill(pid_client, SIGTERM);
         quit_message("ERROR: Failed to run the server.");
     }
 
-    rcv_server_message(0);
+    if (rcv_server_message(0) == -1 || strncmp(reply.data, "OK", 2) != 0) {
+        quit_client();
+        return 1;
+    }
+
+    fb  = shmat(shmget(ftok("server", 'f'), 0, 0666), NULL, SHM_RDONLY);
+    ctl = shmat(shmget(ftok("server", 'c'), 0, 0666), NULL, SHM_RDONLY);
+    if (script) client_pipeline_setup();
 
-    char cmd[10];
+    char cmd[10], text[STRSIZE];
     while (1) {
         if (scanf("%s", cmd) != 1) break;
 
-        if (strcmp(cmd, "add") == 0) {
+        if (strcmp(cmd, "add") == 0 || strcmp(cmd, "del") == 0) {
             int x, y;
             scanf("%d%d", &x, &y);
-            snd_server_message(O_ADD, x, y);
-            rcv_server_message(0);
+            client_cell(x, y, cmd[0] == 'a');
             continue;
         }
+        client_flush_cells();
 
-        if (strcmp(cmd, "del") == 0) {
-            int x, y;
-            scanf("%d%d", &x, &y);
-            snd_server_message(O_DEL, x, y);
-            rcv_server_message(0);
+        if (strcmp(cmd, "load") == 0) {
+            char line[STRSIZE];
+            int x = 1, y = 1;
+            if (!fgets(line, STRSIZE, stdin) ||
+                sscanf(line, "%4095s%d%d", text, &x, &y) < 1) {
+                client_drain();
+                printf("ERROR: Pattern file is not specified.\n");
+                continue;
+            }
+            client_request(O_LOAD, x, y, text, strlen(text));
+            continue;
+        }
+
+        if (strcmp(cmd, "save") == 0 || strcmp(cmd, "restore") == 0) {
+            scanf("%4095s", text);
+            client_request((cmd[0] == 's') ? O_SAVE: O_RESTORE, 0, 0, text, strlen(text));
+            continue;
+        }
+
+        if (strcmp(cmd, "rule") == 0) {
+            scanf("%4095s", text);
+            client_request(O_RULE, 0, 0, text, strlen(text));
+            continue;
+        }
+
+        if (strcmp(cmd, "stream") == 0) {
+            char line[STRSIZE];
+            int every = -1;
+            text[0] = 0;
+            if (!fgets(line, STRSIZE, stdin) ||
+                sscanf(line, "%d%4095s", &every, text) < 1 ||
+                (every > 0 && !text[0])) {
+                client_drain();
+                printf("ERROR: Usage: stream <every_n> <path> or stream 0.\n");
+                continue;
+            }
+            client_request(O_STREAM, every, 0, text, strlen(text));
             continue;
         }
 
         if (strcmp(cmd, "clear") == 0) {
-            snd_server_message(O_CLEAR, 0, 0);
-            rcv_server_message(0);
+            client_request(O_CLEAR, 0, 0, NULL, 0);
             continue;
         }
 
         if (strcmp(cmd, "start") == 0) {
-            int gen;
-            scanf("%d", &gen);
-            snd_server_message(O_START, gen, 0);
-            rcv_server_message(0);
+            char line[STRSIZE];
+            int gen = 0;
+            if (fgets(line, STRSIZE, stdin)) sscanf(line, "%d", &gen);
+            client_request(O_START, gen, 0, NULL, 0);
+            continue;
+        }
+
+        if (strcmp(cmd, "wait") == 0) {
+            client_request(O_WAIT, 0, 0, NULL, 0);
+            client_drain();
             continue;
         }
 
         if (strcmp(cmd, "stop") == 0) {
-            snd_server_message(O_STOP, 0, 0);
-            rcv_server_message(0);
+            client_request(O_STOP, 0, 0, NULL, 0);
             continue;
         }
 
         if (strcmp(cmd, "snapshot") == 0) {
-            snd_server_message(O_SNAP, 0, 0);
-            rcv_server_message(0);
-            for (int i = 0; i < M; i++)
-                rcv_server_message(0);
+            char line[STRSIZE], mode[STRSIZE];
+            int delta = fgets(line, STRSIZE, stdin) && sscanf(line, "%4095s", mode) == 1 &&
+                        strcmp(mode, "delta") == 0;
+            client_request(O_SNAP, 0, delta, NULL, 0);
+            client_drain();
+            continue;
+        }
+
+        if (strcmp(cmd, "stats") == 0) {
+            client_request(O_STATS, 0, 0, NULL, 0);
+            client_drain();
             continue;
         }
 
         if (strcmp(cmd, "quit") == 0) {
-            snd_server_message(O_QUIT, 0, 0);
-            rcv_server_message(0);
+            client_request(O_QUIT, 0, 0, NULL, 0);
+            client_drain();
             msgctl(msgid, IPC_RMID, NULL);
             break;
         }
@@ -206,13 +497,17 @@ int main(int argc, char *argv[]) {
         if (strcmp(cmd, "sleep") == 0) {
             int time = 0;
             scanf("%d", &time);
+            client_drain();
             sleep(time);
             continue;
         }
 
+        client_drain();
         printf("ERROR: Such operation is not supported.\n");
-    }
-
+    }
+
+    client_flush_cells();
+    client_drain();
     quit_client();
     return 0;
 }
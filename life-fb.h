@@ -0,0 +1,152 @@
+/**
+ * @file life-fb.h
+ *
+ * Общий кадр "вселенной" для скриншотов. Сервер создает сегмент
+ * разделяемой памяти, в котором лежат заголовок struct life_fb и два
+ * буфера по rows*cols байт (строки подряд, без разделителей). По команде
+ * O_SNAP каждый рабочий копирует свой блок в задний буфер, после чего
+ * сервер помечает буфер номером поколения и делает его передним. Клиент
+ * читает передний буфер напрямую, не получая строки сообщениями.
+ *
+ * За буферами лежат K списков изменений struct fb_delta, по одному на
+ * рабочего. По команде "snapshot delta" после O_SNAP рабочий i сравнивает
+ * полосу строк life_split(rows, K, i).. заднего буфера с передним (то есть
+ * с последним скриншотом, который получил клиент) и записывает отрезки
+ * изменившихся клеток. Новые состояния клеток отрезков клиент читает из
+ * буфера, ставшего передним. Списки рабочих идут по порядку полос,
+ * поэтому вместе они упорядочены по строкам.
+ */
+
+#ifndef LIFE_FB_H
+#define LIFE_FB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/** @brief наибольшее число отрезков в списке изменений рабочего; если
+ * изменений больше, клиент печатает кадр целиком */
+#define FB_DELTA_RUNS 16384
+
+/** @brief заголовок сегмента кадра */
+struct life_fb {
+    /** @brief число клеток "вселенной" по вертикали */
+    int rows;
+    /** @brief число клеток "вселенной" по горизонтали */
+    int cols;
+    /** @brief номер переднего (последнего готового) буфера: 0 или 1 */
+    uint32_t front;
+    /** @brief номер поколения, записанного в каждый из буферов */
+    int64_t generation[2];
+    /** @brief число рабочих (списков изменений) */
+    int workers;
+};
+
+/** @brief отрезок изменившихся клеток одной строки */
+struct fb_run {
+    /** @brief номер строки, начиная с 0 */
+    int32_t row;
+    /** @brief номер первой клетки отрезка, начиная с 0 */
+    int32_t col;
+    /** @brief длина отрезка */
+    int32_t len;
+};
+
+/** @brief список изменений рабочего */
+struct fb_delta {
+    /** @brief число отрезков */
+    int32_t count;
+    /** @brief отрезки не поместились в список */
+    int32_t overflow;
+    /** @brief отрезки по возрастанию строк и столбцов */
+    struct fb_run run[FB_DELTA_RUNS];
+};
+
+/**
+ * Размер сегмента кадра.
+ *
+ * @param[in] rows число клеток по вертикали
+ * @param[in] cols число клеток по горизонтали
+ * @param[in] workers число рабочих
+ * @return размер в байтах
+ */
+static inline size_t fb_size(int rows, int cols, int workers) {
+    size_t cells = (2 * (size_t) rows * cols + 7) & ~(size_t) 7;
+    return sizeof(struct life_fb) + cells + sizeof(struct fb_delta) * (size_t) workers;
+}
+
+/**
+ * Начало буфера кадра.
+ *
+ * @param[in] fb сегмент кадра
+ * @param[in] b номер буфера (0 или 1)
+ * @return указатель на первую клетку первой строки
+ */
+static inline char *fb_buffer(struct life_fb *fb, int b) {
+    return (char *) (fb + 1) + (size_t) b * fb->rows * fb->cols;
+}
+
+/**
+ * Строка буфера кадра.
+ *
+ * @param[in] fb сегмент кадра
+ * @param[in] b номер буфера (0 или 1)
+ * @param[in] x номер строки, начиная с 0
+ * @return указатель на первую клетку строки
+ */
+static inline char *fb_row(struct life_fb *fb, int b, int x) {
+    return fb_buffer(fb, b) + (size_t) x * fb->cols;
+}
+
+/**
+ * Список изменений рабочего.
+ *
+ * @param[in] fb сегмент кадра
+ * @param[in] i номер рабочего
+ * @return список изменений
+ */
+static inline struct fb_delta *fb_delta(struct life_fb *fb, int i) {
+    size_t cells = (2 * (size_t) fb->rows * fb->cols + 7) & ~(size_t) 7;
+    return (struct fb_delta *) ((char *) (fb + 1) + cells) + i;
+}
+
+/**
+ * Записать изменения строк x0..x1-1 между буфером b и другим буфером
+ * отрезками изменившихся клеток. Совпадающие строки пропускаются
+ * сравнением целиком.
+ *
+ * @param[in] fb сегмент кадра
+ * @param[in] b номер нового буфера (0 или 1)
+ * @param[in] x0 первая строка полосы
+ * @param[in] x1 строка за последней строкой полосы
+ * @param[out] d список изменений
+ */
+static inline void fb_delta_rows(struct life_fb *fb, int b, int x0, int x1, struct fb_delta *d) {
+    int count = 0, cols = fb->cols;
+
+    d->overflow = 0;
+    for (int x = x0; x < x1 && !d->overflow; x++) {
+        const char *curr = fb_row(fb, b, x);
+        const char *prev = fb_row(fb, 1 - b, x);
+        if (memcmp(curr, prev, cols) == 0) continue;
+
+        for (int y = 0; y < cols; y++) {
+            if (curr[y] == prev[y]) continue;
+            if (count == FB_DELTA_RUNS) {
+                d->overflow = 1;
+                break;
+            }
+
+            int len = 1;
+            while (y + len < cols && curr[y+len] != prev[y+len]) len++;
+            d->run[count].row = x;
+            d->run[count].col = y;
+            d->run[count].len = len;
+            count++;
+            y += len;
+        }
+    }
+    d->count = count;
+}
+
+#endif
@@ -0,0 +1,354 @@
+/**
+ * @file life-hash.c
+ *
+ * Квадродерево HashLife: узлы лежат в растущем массиве и адресуются
+ * номерами, поэтому после перевыделения памяти указатели на узлы не
+ * хранятся. Одинаковые узлы находятся через хеш-таблицу с цепочками.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "life-hash.h"
+
+/**
+ * Проверить, что число — степень двойки, и найти ее показатель.
+ *
+ * @param[in] n число
+ * @return показатель или -1
+ */
+static int hash_log2(int n) {
+    if (n < 1 || (n & (n-1))) return -1;
+    return __builtin_ctz(n);
+}
+
+/**
+ * Очистить память узлов: остаются только два листа.
+ *
+ * @param[in,out] h память узлов
+ */
+static void hash_reset(struct hash_life *h) {
+    memset(h->bucket, 0, h->buckets * sizeof(uint32_t));
+    memset(h->empty, 0, sizeof(h->empty));
+    memset(h->node, 0, 2 * sizeof(struct hash_node));
+    h->count = 2;
+}
+
+/**
+ * Хеш четверки потомков.
+ */
+static inline uint32_t hash_key(uint32_t nw, uint32_t ne, uint32_t sw, uint32_t se) {
+    uint64_t k = nw * 0x9e3779b97f4a7c15ull;
+    k = (k ^ ne) * 0xff51afd7ed558ccdull;
+    k = (k ^ sw) * 0xc4ceb9fe1a85ec53ull;
+    k = (k ^ se) * 0x9e3779b97f4a7c15ull;
+    return (uint32_t) (k >> 32);
+}
+
+/**
+ * Увеличить хеш-таблицу вдвое и перераспределить цепочки.
+ *
+ * @param[in,out] h память узлов
+ */
+static void hash_grow(struct hash_life *h) {
+    uint32_t buckets = 2 * h->buckets;
+    uint32_t *bucket = (uint32_t *) calloc(buckets, sizeof(uint32_t));
+
+    for (uint32_t n = 2; n < h->count; n++) {
+        const uint32_t *c = h->node[n].child;
+        uint32_t b = hash_key(c[0], c[1], c[2], c[3]) & (buckets-1);
+        h->node[n].next = bucket[b];
+        bucket[b] = n;
+    }
+    free(h->bucket);
+    h->bucket  = bucket;
+    h->buckets = buckets;
+}
+
+/**
+ * Найти или создать узел с данными потомками.
+ *
+ * @param[in,out] h память узлов
+ * @param[in] nw северо-западный потомок
+ * @param[in] ne северо-восточный потомок
+ * @param[in] sw юго-западный потомок
+ * @param[in] se юго-восточный потомок
+ * @return номер узла
+ */
+static uint32_t hash_make(struct hash_life *h, uint32_t nw, uint32_t ne, uint32_t sw, uint32_t se) {
+    uint32_t b = hash_key(nw, ne, sw, se) & (h->buckets-1);
+    for (uint32_t n = h->bucket[b]; n; n = h->node[n].next) {
+        const uint32_t *c = h->node[n].child;
+        if (c[0] == nw && c[1] == ne && c[2] == sw && c[3] == se) return n;
+    }
+
+    if (h->count == h->size) {
+        h->size *= 2;
+        h->node = (struct hash_node *) realloc(h->node, h->size * sizeof(struct hash_node));
+    }
+    uint32_t n = h->count++;
+    struct hash_node *p = &h->node[n];
+    p->child[0] = nw;
+    p->child[1] = ne;
+    p->child[2] = sw;
+    p->child[3] = se;
+    p->result = 0;
+    p->level  = h->node[nw].level + 1;
+    p->next   = h->bucket[b];
+    h->bucket[b] = n;
+
+    if (h->count > h->buckets) hash_grow(h);
+    return n;
+}
+
+/**
+ * Пустой узел уровня level.
+ */
+static uint32_t hash_empty(struct hash_life *h, int level) {
+    if (level == 0) return 0;
+    if (!h->empty[level]) {
+        uint32_t e = hash_empty(h, level-1);
+        h->empty[level] = hash_make(h, e, e, e, e);
+    }
+    return h->empty[level];
+}
+
+/** @brief потомок q узла n */
+#define CHILD(h, n, q) ((h)->node[n].child[q])
+
+/**
+ * Результат узла уровня 2: центральные 2x2 клетки квадрата 4x4 через
+ * одно поколение.
+ *
+ * @param[in,out] h память узлов
+ * @param[in] n узел
+ * @return узел уровня 1
+ */
+static uint32_t hash_base(struct hash_life *h, uint32_t n) {
+    int cell[4][4], next[4];
+
+    for (int x = 0; x < 4; x++) {
+        for (int y = 0; y < 4; y++)
+            cell[x][y] = CHILD(h, CHILD(h, n, (x/2)*2 + y/2), (x%2)*2 + y%2);
+    }
+    for (int x = 1; x <= 2; x++) {
+        for (int y = 1; y <= 2; y++) {
+            int s = -cell[x][y];
+            for (int a = x-1; a <= x+1; a++) s += cell[a][y-1] + cell[a][y] + cell[a][y+1];
+            next[(x-1)*2 + y-1] = (cell[x][y]) ? h->survive >> s & 1: h->birth >> s & 1;
+        }
+    }
+    return hash_make(h, next[0], next[1], next[2], next[3]);
+}
+
+/**
+ * Результат узла: центральная половина квадрата через 2^(level-2)
+ * поколений. Строятся девять перекрывающихся узлов уровнем ниже, их
+ * результаты (через 2^(level-3) поколений) складываются в четыре узла, и
+ * результаты этих узлов дают еще 2^(level-3) поколений.
+ *
+ * @param[in,out] h память узлов
+ * @param[in] n узел уровня не меньше 2
+ * @return узел уровнем ниже
+ */
+static uint32_t hash_result(struct hash_life *h, uint32_t n) {
+    if (h->node[n].result) return h->node[n].result;
+    if (h->node[n].level == 2) {
+        uint32_t r = hash_base(h, n);
+        h->node[n].result = r;
+        return r;
+    }
+
+    uint32_t nw = CHILD(h, n, 0), ne = CHILD(h, n, 1), sw = CHILD(h, n, 2), se = CHILD(h, n, 3);
+    uint32_t t[9];
+    t[0] = hash_result(h, nw);
+    t[1] = hash_result(h, hash_make(h, CHILD(h, nw, 1), CHILD(h, ne, 0), CHILD(h, nw, 3), CHILD(h, ne, 2)));
+    t[2] = hash_result(h, ne);
+    t[3] = hash_result(h, hash_make(h, CHILD(h, nw, 2), CHILD(h, nw, 3), CHILD(h, sw, 0), CHILD(h, sw, 1)));
+    t[4] = hash_result(h, hash_make(h, CHILD(h, nw, 3), CHILD(h, ne, 2), CHILD(h, sw, 1), CHILD(h, se, 0)));
+    t[5] = hash_result(h, hash_make(h, CHILD(h, ne, 2), CHILD(h, ne, 3), CHILD(h, se, 0), CHILD(h, se, 1)));
+    t[6] = hash_result(h, sw);
+    t[7] = hash_result(h, hash_make(h, CHILD(h, sw, 1), CHILD(h, se, 0), CHILD(h, sw, 3), CHILD(h, se, 2)));
+    t[8] = hash_result(h, se);
+
+    uint32_t q[4];
+    q[0] = hash_result(h, hash_make(h, t[0], t[1], t[3], t[4]));
+    q[1] = hash_result(h, hash_make(h, t[1], t[2], t[4], t[5]));
+    q[2] = hash_result(h, hash_make(h, t[3], t[4], t[6], t[7]));
+    q[3] = hash_result(h, hash_make(h, t[4], t[5], t[7], t[8]));
+
+    uint32_t r = hash_make(h, q[0], q[1], q[2], q[3]);
+    h->node[n].result = r;
+    return r;
+}
+
+int hash_init(struct hash_life *h, int rows, int cols) {
+    int a = hash_log2(rows), b = hash_log2(cols);
+    if (a == -1 || b == -1) return -1;
+
+    h->rows    = rows;
+    h->cols    = cols;
+    h->depth   = (a > b) ? a: b;
+    h->birth   = 1 << 3;
+    h->survive = (1 << 2) | (1 << 3);
+    h->size    = 1 << 16;
+    h->buckets = 1 << 16;
+    h->node    = (struct hash_node *) malloc(h->size * sizeof(struct hash_node));
+    h->bucket  = (uint32_t *) malloc(h->buckets * sizeof(uint32_t));
+    hash_reset(h);
+    return 0;
+}
+
+void hash_free(struct hash_life *h) {
+    free(h->node);
+    free(h->bucket);
+}
+
+void hash_rule(struct hash_life *h, uint16_t birth, uint16_t survive) {
+    if (h->birth == birth && h->survive == survive) return;
+    h->birth   = birth;
+    h->survive = survive;
+    hash_reset(h);
+}
+
+/**
+ * Построить узел по квадрату карты; карта продолжается периодически.
+ *
+ * @param[in,out] h память узлов
+ * @param[in] cells карта клеток
+ * @param[in] level уровень узла
+ * @param[in] x0 верхняя строка квадрата
+ * @param[in] y0 левый столбец квадрата
+ * @return номер узла
+ */
+static uint32_t hash_build(struct hash_life *h, const char *cells, int level, int x0, int y0) {
+    if (level == 0) return cells[(x0 % h->rows) * h->cols + y0 % h->cols] == '*';
+
+    int half = 1 << (level-1);
+    uint32_t nw = hash_build(h, cells, level-1, x0,      y0);
+    uint32_t ne = hash_build(h, cells, level-1, x0,      y0+half);
+    uint32_t sw = hash_build(h, cells, level-1, x0+half, y0);
+    uint32_t se = hash_build(h, cells, level-1, x0+half, y0+half);
+    return hash_make(h, nw, ne, sw, se);
+}
+
+uint32_t hash_import(struct hash_life *h, const char *cells) {
+    if (h->count > HASH_NODES_MAX) hash_reset(h);
+    hash_empty(h, h->depth);
+    return hash_build(h, cells, h->depth, 0, 0);
+}
+
+/**
+ * Записать живые клетки узла в карту. Пустые узлы (построенные при
+ * импорте) и клетки за пределами "вселенной" пропускаются.
+ */
+static void hash_paint(const struct hash_life *h, uint32_t n, int level, int x0, int y0, char *cells) {
+    if (x0 >= h->rows || y0 >= h->cols || n == h->empty[level]) return;
+    if (level == 0) {
+        cells[x0 * h->cols + y0] = '*';
+        return;
+    }
+
+    int half = 1 << (level-1);
+    hash_paint(h, CHILD(h, n, 0), level-1, x0,      y0,      cells);
+    hash_paint(h, CHILD(h, n, 1), level-1, x0,      y0+half, cells);
+    hash_paint(h, CHILD(h, n, 2), level-1, x0+half, y0,      cells);
+    hash_paint(h, CHILD(h, n, 3), level-1, x0+half, y0+half, cells);
+}
+
+void hash_export(const struct hash_life *h, uint32_t root, char *cells) {
+    memset(cells, '.', (size_t) h->rows * h->cols);
+    hash_paint(h, root, h->depth, 0, 0, cells);
+}
+
+/**
+ * Разложить узел на квадраты уровня level.
+ *
+ * @param[in] h память узлов
+ * @param[in] n узел
+ * @param[in] depth уровень узла
+ * @param[in] level уровень квадратов
+ * @param[in] r0 ряд левого верхнего квадрата узла
+ * @param[in] c0 колонка левого верхнего квадрата узла
+ * @param[in] g число квадратов в ряду таблицы
+ * @param[out] tile таблица квадратов
+ */
+static void hash_tiles(const struct hash_life *h, uint32_t n, int depth, int level,
+                       int r0, int c0, int g, uint32_t *tile) {
+    if (depth == level) {
+        tile[r0*g + c0] = n;
+        return;
+    }
+
+    int half = 1 << (depth-1-level);
+    hash_tiles(h, CHILD(h, n, 0), depth-1, level, r0,      c0,      g, tile);
+    hash_tiles(h, CHILD(h, n, 1), depth-1, level, r0,      c0+half, g, tile);
+    hash_tiles(h, CHILD(h, n, 2), depth-1, level, r0+half, c0,      g, tile);
+    hash_tiles(h, CHILD(h, n, 3), depth-1, level, r0+half, c0+half, g, tile);
+}
+
+/**
+ * Собрать узел из квадратной части таблицы узлов (операция, обратная
+ * hash_tiles()).
+ *
+ * @param[in,out] h память узлов
+ * @param[in] tile таблица узлов
+ * @param[in] g число узлов в ряду таблицы
+ * @param[in] r0 первый ряд части
+ * @param[in] c0 первая колонка части
+ * @param[in] size сторона части (степень двойки)
+ * @return номер узла
+ */
+static uint32_t hash_compose(struct hash_life *h, const uint32_t *tile, int g, int r0, int c0, int size) {
+    if (size == 1) return tile[r0*g + c0];
+
+    int half = size / 2;
+    uint32_t nw = hash_compose(h, tile, g, r0,      c0,      half);
+    uint32_t ne = hash_compose(h, tile, g, r0,      c0+half, half);
+    uint32_t sw = hash_compose(h, tile, g, r0+half, c0,      half);
+    uint32_t se = hash_compose(h, tile, g, r0+half, c0+half, half);
+    return hash_make(h, nw, ne, sw, se);
+}
+
+/**
+ * Построить 2^j поколений, если 2^(j+1) не больше стороны корня.
+ * Плоскость делится на квадраты уровня j; каждый блок из 2x2 квадратов
+ * будущего поколения — результат узла из 4x4 квадратов вокруг него.
+ */
+static uint32_t hash_advance_tiles(struct hash_life *h, uint32_t root, int j) {
+    int g = 1 << (h->depth - j), blocks = g / 2;
+    uint32_t *tile = (uint32_t *) malloc((size_t) g * g * sizeof(uint32_t));
+    uint32_t *res  = (uint32_t *) malloc((size_t) blocks * blocks * sizeof(uint32_t));
+    hash_tiles(h, root, h->depth, j, 0, 0, g, tile);
+
+    for (int a = 0; a < blocks; a++) {
+        for (int b = 0; b < blocks; b++) {
+            uint32_t t[4][4], q[4];
+            for (int u = 0; u < 4; u++) {
+                for (int v = 0; v < 4; v++)
+                    t[u][v] = tile[((2*a-1+u+g) % g) * g + (2*b-1+v+g) % g];
+            }
+            for (int k = 0; k < 4; k++) {
+                int u = (k/2)*2, v = (k%2)*2;
+                q[k] = hash_make(h, t[u][v], t[u][v+1], t[u+1][v], t[u+1][v+1]);
+            }
+            res[a*blocks + b] = hash_result(h, hash_make(h, q[0], q[1], q[2], q[3]));
+        }
+    }
+
+    root = hash_compose(h, res, blocks, 0, 0, blocks);
+    free(tile);
+    free(res);
+    return root;
+}
+
+uint32_t hash_advance(struct hash_life *h, uint32_t root, int j) {
+    if (j < h->depth) return hash_advance_tiles(h, root, j);
+
+    /* узел из копий корня: его результат сдвинут на 2^j клеток, что
+     * кратно стороне корня, поэтому новый корень — его угол */
+    uint32_t p = root;
+    for (int level = h->depth; level < j+2; level++) p = hash_make(h, p, p, p, p);
+    p = hash_result(h, p);
+    while (h->node[p].level > h->depth) p = CHILD(h, p, 0);
+    return p;
+}
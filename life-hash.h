@@ -0,0 +1,126 @@
+/**
+ * @file life-hash.h
+ *
+ * Моделирование "вселенной" алгоритмом HashLife Госпера. Квадрат
+ * 2^k x 2^k клеток хранится квадродеревом, одинаковые поддеревья хранятся
+ * один раз (узлы канонизируются через хеш-таблицу), а результат узла —
+ * его центральная половина через 2^(k-2) поколений — запоминается в
+ * самом узле. Это позволяет строить за один шаг 2^j поколений.
+ *
+ * "Вселенная" замкнута в тор, поэтому она рассматривается как бесконечная
+ * плоскость, замощенная ее копиями; для этого ее размеры должны быть
+ * степенями двойки. Модуль не использует IPC и работает только с
+ * переданными ему картами клеток.
+ */
+
+#ifndef LIFE_HASH_H
+#define LIFE_HASH_H
+
+#include <stdint.h>
+
+/** @brief число узлов, после которого память узлов очищается при
+ * очередном импорте карты */
+#define HASH_NODES_MAX (1 << 22)
+/** @brief наибольший уровень узла */
+#define HASH_LEVELS 64
+
+/** @brief узел квадродерева */
+struct hash_node {
+    /** @brief потомки: северо-западный, северо-восточный, юго-западный,
+     * юго-восточный (у листьев не используются) */
+    uint32_t child[4];
+    /** @brief результат узла или 0, если он еще не вычислен */
+    uint32_t result;
+    /** @brief следующий узел в цепочке хеш-таблицы */
+    uint32_t next;
+    /** @brief уровень: узел описывает квадрат 2^level x 2^level */
+    int32_t level;
+};
+
+/** @brief память узлов HashLife
+ *
+ * Узлы 0 и 1 — мертвая и живая клетки (листья), поэтому номер листа
+ * совпадает с состоянием клетки. */
+struct hash_life {
+    /** @brief узлы */
+    struct hash_node *node;
+    /** @brief число узлов */
+    uint32_t count;
+    /** @brief размер выделенной памяти (в узлах) */
+    uint32_t size;
+    /** @brief хеш-таблица: первый узел каждой цепочки */
+    uint32_t *bucket;
+    /** @brief число цепочек (степень двойки) */
+    uint32_t buckets;
+    /** @brief пустые узлы каждого уровня (0 — еще не построен) */
+    uint32_t empty[HASH_LEVELS];
+    /** @brief маска рождения правила (бит n — n соседей) */
+    uint16_t birth;
+    /** @brief маска выживания правила */
+    uint16_t survive;
+    /** @brief число клеток "вселенной" по вертикали */
+    int rows;
+    /** @brief число клеток "вселенной" по горизонтали */
+    int cols;
+    /** @brief уровень корня: сторона квадрата, вмещающего "вселенную" */
+    int depth;
+};
+
+/**
+ * Подготовить память узлов для "вселенной" rows x cols по правилу
+ * Конвея.
+ *
+ * @param[out] h память узлов
+ * @param[in] rows число клеток по вертикали
+ * @param[in] cols число клеток по горизонтали
+ * @return 0 при успехе, -1, если размеры не являются степенями двойки
+ */
+int hash_init(struct hash_life *h, int rows, int cols);
+
+/**
+ * Освободить память узлов.
+ *
+ * @param[in,out] h память узлов
+ */
+void hash_free(struct hash_life *h);
+
+/**
+ * Задать правило. Если правило изменилось, запомненные результаты
+ * становятся неверными, и память узлов очищается.
+ *
+ * @param[in,out] h память узлов
+ * @param[in] birth маска рождения
+ * @param[in] survive маска выживания
+ */
+void hash_rule(struct hash_life *h, uint16_t birth, uint16_t survive);
+
+/**
+ * Построить квадродерево по карте клеток. Если узлов больше
+ * HASH_NODES_MAX, память узлов предварительно очищается.
+ *
+ * @param[in,out] h память узлов
+ * @param[in] cells карта rows x cols ('*' / '.'), строки подряд
+ * @return корень уровня depth
+ */
+uint32_t hash_import(struct hash_life *h, const char *cells);
+
+/**
+ * Записать квадродерево в карту клеток.
+ *
+ * @param[in] h память узлов
+ * @param[in] root корень уровня depth
+ * @param[out] cells карта rows x cols, строки подряд
+ */
+void hash_export(const struct hash_life *h, uint32_t root, char *cells);
+
+/**
+ * Построить 2^j поколений.
+ *
+ * @param[in,out] h память узлов
+ * @param[in] root корень уровня depth
+ * @param[in] j показатель числа поколений
+ * @return новый корень уровня depth
+ */
+uint32_t hash_advance(struct hash_life *h, uint32_t root, int j);
+
+#endif
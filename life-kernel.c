@@ -0,0 +1,398 @@
+/**
+ * @file life-kernel.c
+ *
+ * Вычислительные ядра рабочего. В упакованном представлении каждая
+ * строка полосы хранится как массив слов uint64_t, клетка j находится в
+ * бите j % 64 слова j / 64. Соседи подсчитываются сразу для 64 клеток
+ * с помощью побитовых сумматоров.
+ *
+ * Векторные байтовые ядра пользуются тем, что '.' - '*' == 4: разность
+ * '.' - c равна 4 для живой клетки и 0 для мертвой, поэтому сумма таких
+ * разностей по окрестности 3x3 равна учетверенному числу живых клеток.
+ * Сначала складываются вертикальные тройки, затем три сдвинутые суммы.
+ * Новое состояние клетки AVX2 и AVX-512 берут из таблиц правила по числу
+ * соседей (pshufb), скалярное ядро — из таблицы по окрестности 3x3.
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include "life-kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNEL_X86 1
+#endif
+
+int kernel_detect(void) {
+#ifdef KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) return KERNEL_AVX512;
+    if (__builtin_cpu_supports("avx2"))     return KERNEL_AVX2;
+    if (__builtin_cpu_supports("sse2"))     return KERNEL_SSE2;
+#endif
+    return KERNEL_SCALAR;
+}
+
+int kernel_by_name(const char *name) {
+    int best = kernel_detect();
+
+    if (strcmp(name, "auto") == 0)   return best;
+    if (strcmp(name, "scalar") == 0) return KERNEL_SCALAR;
+    if (strcmp(name, "bits") == 0)   return KERNEL_BITS;
+    if (strcmp(name, "sse2") == 0)   return (best >= KERNEL_SSE2) ? KERNEL_SSE2: best;
+    if (strcmp(name, "avx2") == 0)   return (best >= KERNEL_AVX2) ? KERNEL_AVX2: best;
+    if (strcmp(name, "avx512") == 0) return best;
+    return -1;
+}
+
+/**
+ * Разобрать половину записи правила (до или после косой черты).
+ *
+ * @param[in] s начало половины
+ * @param[in] len длина половины
+ * @param[in] kind вид половины, если она не начинается с буквы: 0 —
+ * рождение, 1 — выживание
+ * @param[in,out] mask маски рождения (0) и выживания (1)
+ * @return вид половины или -1, если она записана неверно
+ */
+static int kernel_rule_half(const char *s, int len, int kind, uint16_t mask[2]) {
+    if (len > 0 && (toupper((unsigned char) s[0]) == 'B' || toupper((unsigned char) s[0]) == 'S')) {
+        kind = (toupper((unsigned char) s[0]) == 'B') ? 0: 1;
+        s++;
+        len--;
+    }
+    for (int k = 0; k < len; k++) {
+        if (s[k] < '0' || s[k] > '8') return -1;
+        mask[kind] |= 1 << (s[k] - '0');
+    }
+    return kind;
+}
+
+int kernel_rule_parse(const char *text, uint16_t *birth, uint16_t *survive) {
+    const char *slash = strchr(text, '/');
+    if (!slash) return -1;
+
+    uint16_t mask[2] = {0, 0};
+    int a = kernel_rule_half(text, slash - text, 1, mask);
+    int b = kernel_rule_half(slash + 1, strlen(slash + 1), 0, mask);
+    if (a == -1 || b == -1 || a == b) return -1;
+
+    *birth   = mask[0];
+    *survive = mask[1];
+    return 0;
+}
+
+void kernel_rule_format(uint16_t birth, uint16_t survive, char *text) {
+    int len = sprintf(text, "B");
+    for (int n = 0; n <= 8; n++) {
+        if (birth >> n & 1) len += sprintf(text + len, "%d", n);
+    }
+    len += sprintf(text + len, "/S");
+    for (int n = 0; n <= 8; n++) {
+        if (survive >> n & 1) len += sprintf(text + len, "%d", n);
+    }
+}
+
+void kernel_rule_make(uint16_t birth, uint16_t survive, struct kernel_rule *rule) {
+    rule->birth   = birth;
+    rule->survive = survive;
+    rule->conway  = birth == 1 << 3 && survive == ((1 << 2) | (1 << 3));
+
+    for (int idx = 0; idx < 512; idx++) {
+        int self = idx >> 4 & 1;
+        int n = __builtin_popcount(idx) - self;
+        int alive = (self) ? survive >> n & 1: birth >> n & 1;
+        rule->lut[idx] = (alive) ? '*': '.';
+    }
+    for (int n = 0; n < 16; n++) {
+        rule->birth_tab[n]   = (n <= 8 && birth >> n & 1) ? 0xff: 0;
+        rule->survive_tab[n] = (n <= 8 && survive >> n & 1) ? 0xff: 0;
+    }
+}
+
+/**
+ * Столбец окрестности 3x3: живые клетки столбца j строк a, b, c
+ * складываются в биты 0, 1, 2.
+ */
+static inline unsigned kernel_lut_column(const char *a, const char *b, const char *c, int j) {
+    return (a[j] == '*') | (b[j] == '*') << 1 | (c[j] == '*') << 2;
+}
+
+/**
+ * Вычислить одну клетку байтовой карты по таблице правила.
+ *
+ * @param[in] rule правило
+ * @param[in] prev карта последнего смоделированного поколения
+ * @param[in] i номер строки
+ * @param[in] j номер столбца
+ * @return новое состояние клетки
+ */
+static inline char kernel_byte_cell(const struct kernel_rule *rule, char **prev, int i, int j) {
+    const char *a = prev[i-1], *b = prev[i], *c = prev[i+1];
+    return rule->lut[kernel_lut_column(a, b, c, j-1) << 6 |
+                     kernel_lut_column(a, b, c, j) << 3 |
+                     kernel_lut_column(a, b, c, j+1)];
+}
+
+/**
+ * Построить очередное поколение скалярным ядром: строка проходится
+ * окном 3x3, индекс таблицы правила на каждом шаге сдвигается на один
+ * столбец.
+ */
+static void kernel_lut_step(const struct kernel_rule *rule, char **prev, char **curr,
+                            int x0, int x1, int y0, int y1) {
+    for (int i = x0; i <= x1; i++) {
+        const char *a = prev[i-1], *b = prev[i], *c = prev[i+1];
+        char *d = curr[i];
+        unsigned idx = kernel_lut_column(a, b, c, y0-1) << 3 | kernel_lut_column(a, b, c, y0);
+
+        for (int j = y0; j <= y1; j++) {
+            idx = (idx << 3 | kernel_lut_column(a, b, c, j+1)) & 0x1ff;
+            d[j] = rule->lut[idx];
+        }
+    }
+}
+
+#ifdef KERNEL_X86
+/**
+ * Построить очередное поколение ядром SSE2 (16 клеток за итерацию). В
+ * SSE2 нет перестановки байтов по таблице, поэтому ядро строит только
+ * правило Конвея.
+ */
+__attribute__((target("sse2")))
+static void kernel_sse2_step(const struct kernel_rule *rule, char **prev, char **curr,
+                             int x0, int x1, int y0, int y1) {
+    const __m128i dot = _mm_set1_epi8('.'), four = _mm_set1_epi8(4);
+    const __m128i c12 = _mm_set1_epi8(12),  c16 = _mm_set1_epi8(16);
+
+    for (int i = x0; i <= x1; i++) {
+        const char *a = prev[i-1], *b = prev[i], *c = prev[i+1];
+        int j = y0;
+        for (; j + 15 <= y1; j += 16) {
+            __m128i v[3];
+            for (int k = 0; k < 3; k++) {
+                __m128i ra = _mm_sub_epi8(dot, _mm_loadu_si128((const __m128i *) (a+j-1+k)));
+                __m128i rb = _mm_sub_epi8(dot, _mm_loadu_si128((const __m128i *) (b+j-1+k)));
+                __m128i rc = _mm_sub_epi8(dot, _mm_loadu_si128((const __m128i *) (c+j-1+k)));
+                v[k] = _mm_add_epi8(_mm_add_epi8(ra, rb), rc);
+            }
+            __m128i sum  = _mm_add_epi8(_mm_add_epi8(v[0], v[1]), v[2]);
+            __m128i self = _mm_sub_epi8(dot, _mm_loadu_si128((const __m128i *) (b+j)));
+            __m128i born = _mm_cmpeq_epi8(sum, c12);
+            __m128i keep = _mm_and_si128(_mm_cmpeq_epi8(sum, c16), _mm_cmpeq_epi8(self, four));
+            __m128i mask = _mm_or_si128(born, keep);
+            _mm_storeu_si128((__m128i *) (curr[i]+j), _mm_sub_epi8(dot, _mm_and_si128(mask, four)));
+        }
+        for (; j <= y1; j++) curr[i][j] = kernel_byte_cell(rule, prev, i, j);
+    }
+}
+
+/**
+ * Построить очередное поколение ядром AVX2 (32 клетки за итерацию).
+ * Число соседей n получается из суммы окрестности за вычетом самой
+ * клетки, новое состояние выбирается из таблиц рождения и выживания.
+ */
+__attribute__((target("avx2")))
+static void kernel_avx2_step(const struct kernel_rule *rule, char **prev, char **curr,
+                             int x0, int x1, int y0, int y1) {
+    const __m256i dot = _mm256_set1_epi8('.'), four = _mm256_set1_epi8(4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i birth   = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) rule->birth_tab));
+    const __m256i survive = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) rule->survive_tab));
+
+    for (int i = x0; i <= x1; i++) {
+        const char *a = prev[i-1], *b = prev[i], *c = prev[i+1];
+        int j = y0;
+        for (; j + 31 <= y1; j += 32) {
+            __m256i v[3];
+            for (int k = 0; k < 3; k++) {
+                __m256i ra = _mm256_sub_epi8(dot, _mm256_loadu_si256((const __m256i *) (a+j-1+k)));
+                __m256i rb = _mm256_sub_epi8(dot, _mm256_loadu_si256((const __m256i *) (b+j-1+k)));
+                __m256i rc = _mm256_sub_epi8(dot, _mm256_loadu_si256((const __m256i *) (c+j-1+k)));
+                v[k] = _mm256_add_epi8(_mm256_add_epi8(ra, rb), rc);
+            }
+            __m256i sum  = _mm256_add_epi8(_mm256_add_epi8(v[0], v[1]), v[2]);
+            __m256i self = _mm256_sub_epi8(dot, _mm256_loadu_si256((const __m256i *) (b+j)));
+            __m256i n    = _mm256_and_si256(_mm256_srli_epi16(_mm256_sub_epi8(sum, self), 2), low);
+            __m256i born = _mm256_shuffle_epi8(birth, n);
+            __m256i keep = _mm256_shuffle_epi8(survive, n);
+            __m256i mask = _mm256_blendv_epi8(born, keep, _mm256_cmpeq_epi8(self, four));
+            _mm256_storeu_si256((__m256i *) (curr[i]+j), _mm256_sub_epi8(dot, _mm256_and_si256(mask, four)));
+        }
+        for (; j <= y1; j++) curr[i][j] = kernel_byte_cell(rule, prev, i, j);
+    }
+}
+
+/**
+ * Построить очередное поколение ядром AVX-512BW (64 клетки за итерацию)
+ * по таблицам правила, как и ядро AVX2.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void kernel_avx512_step(const struct kernel_rule *rule, char **prev, char **curr,
+                               int x0, int x1, int y0, int y1) {
+    const __m512i dot = _mm512_set1_epi8('.'), star = _mm512_set1_epi8('*');
+    const __m512i low = _mm512_set1_epi8(0x0f);
+    const __m512i birth   = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) rule->birth_tab));
+    const __m512i survive = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) rule->survive_tab));
+
+    for (int i = x0; i <= x1; i++) {
+        const char *a = prev[i-1], *b = prev[i], *c = prev[i+1];
+        int j = y0;
+        for (; j + 63 <= y1; j += 64) {
+            __m512i v[3];
+            for (int k = 0; k < 3; k++) {
+                __m512i ra = _mm512_sub_epi8(dot, _mm512_loadu_si512((const void *) (a+j-1+k)));
+                __m512i rb = _mm512_sub_epi8(dot, _mm512_loadu_si512((const void *) (b+j-1+k)));
+                __m512i rc = _mm512_sub_epi8(dot, _mm512_loadu_si512((const void *) (c+j-1+k)));
+                v[k] = _mm512_add_epi8(_mm512_add_epi8(ra, rb), rc);
+            }
+            __m512i sum  = _mm512_add_epi8(_mm512_add_epi8(v[0], v[1]), v[2]);
+            __m512i self = _mm512_sub_epi8(dot, _mm512_loadu_si512((const void *) (b+j)));
+            __m512i n    = _mm512_and_si512(_mm512_srli_epi16(_mm512_sub_epi8(sum, self), 2), low);
+            __mmask64 alive = _mm512_test_epi8_mask(self, self);
+            __mmask64 born  = _mm512_test_epi8_mask(_mm512_shuffle_epi8(birth, n), star);
+            __mmask64 keep  = _mm512_test_epi8_mask(_mm512_shuffle_epi8(survive, n), star);
+            __mmask64 mask  = (born & ~alive) | (keep & alive);
+            _mm512_storeu_si512((void *) (curr[i]+j), _mm512_mask_blend_epi8(mask, dot, star));
+        }
+        for (; j <= y1; j++) curr[i][j] = kernel_byte_cell(rule, prev, i, j);
+    }
+}
+#endif
+
+void kernel_byte_step(int k, const struct kernel_rule *rule, char **prev, char **curr,
+                      int x0, int x1, int y0, int y1) {
+#ifdef KERNEL_X86
+    switch (k) {
+        case KERNEL_SSE2:
+            if (!rule->conway) break;
+            kernel_sse2_step(rule, prev, curr, x0, x1, y0, y1);
+            return;
+        case KERNEL_AVX2:   kernel_avx2_step(rule, prev, curr, x0, x1, y0, y1);   return;
+        case KERNEL_AVX512: kernel_avx512_step(rule, prev, curr, x0, x1, y0, y1); return;
+        default: ;
+    }
+#endif
+    kernel_lut_step(rule, prev, curr, x0, x1, y0, y1);
+}
+
+int kernel_bits_words(int n) {
+    return (n + KERNEL_WORD_BITS - 1) / KERNEL_WORD_BITS;
+}
+
+void kernel_pack_row(const char *src, uint64_t *dst, int n) {
+    memset(dst, 0, kernel_bits_words(n) * sizeof(uint64_t));
+    for (int j = 0; j < n; j++) {
+        if (src[j] == '*')
+            dst[j / KERNEL_WORD_BITS] |= (uint64_t) 1 << (j % KERNEL_WORD_BITS);
+    }
+}
+
+void kernel_unpack_row(const uint64_t *src, char *dst, int first, int n) {
+    for (int j = 0; j < n; j++)
+        dst[j] = kernel_bits_get(src, first + j);
+}
+
+char kernel_bits_get(const uint64_t *row, int j) {
+    return (row[j / KERNEL_WORD_BITS] >> (j % KERNEL_WORD_BITS)) & 1 ? '*': '.';
+}
+
+void kernel_bits_set(uint64_t *row, int j, char c) {
+    uint64_t bit = (uint64_t) 1 << (j % KERNEL_WORD_BITS);
+    if (c == '*') {
+        row[j / KERNEL_WORD_BITS] |= bit;
+    } else row[j / KERNEL_WORD_BITS] &= ~bit;
+}
+
+/**
+ * Сдвинуть строку так, чтобы на месте клетки j оказалась клетка j-1.
+ *
+ * @param[in] row упакованная строка
+ * @param[in] w номер слова
+ * @return слово с левыми соседями клеток слова w
+ */
+static inline uint64_t kernel_west(const uint64_t *row, int w) {
+    return (row[w] << 1) | (w > 0 ? row[w-1] >> 63: 0);
+}
+
+/**
+ * Сдвинуть строку так, чтобы на месте клетки j оказалась клетка j+1.
+ *
+ * @param[in] row упакованная строка
+ * @param[in] w номер слова
+ * @param[in] words число слов в строке
+ * @return слово с правыми соседями клеток слова w
+ */
+static inline uint64_t kernel_east(const uint64_t *row, int w, int words) {
+    return (row[w] >> 1) | (w+1 < words ? row[w+1] << 63: 0);
+}
+
+/**
+ * Применить правило к 64 клеткам по разрядам числа соседей.
+ *
+ * @param[in] rule правило
+ * @param[in] s разряды 1, 2, 4 и 8 числа соседей
+ * @param[in] self текущее состояние клеток
+ * @return новое состояние клеток
+ */
+static inline uint64_t kernel_bits_rule(const struct kernel_rule *rule, const uint64_t s[4], uint64_t self) {
+    uint64_t born = 0, keep = 0;
+
+    for (int n = 0; n <= 8; n++) {
+        if (!((rule->birth | rule->survive) >> n & 1)) continue;
+
+        uint64_t eq = ~(uint64_t) 0;
+        for (int k = 0; k < 4; k++) eq &= (n >> k & 1) ? s[k]: ~s[k];
+        if (rule->birth >> n & 1)   born |= eq;
+        if (rule->survive >> n & 1) keep |= eq;
+    }
+    return (born & ~self) | (keep & self);
+}
+
+void kernel_bits_step(const struct kernel_rule *rule, uint64_t **prev, uint64_t **curr,
+                      int x0, int x1, int n) {
+    int words = kernel_bits_words(n+2);
+    uint64_t tail = ((uint64_t) 1 << ((n+1) % KERNEL_WORD_BITS)) - 1;
+
+    for (int i = x0; i <= x1; i++) {
+        const uint64_t *a = prev[i-1], *b = prev[i], *c = prev[i+1];
+        uint64_t *d = curr[i];
+
+        for (int w = 0; w < words; w++) {
+            uint64_t aw = kernel_west(a, w), ae = kernel_east(a, w, words);
+            uint64_t bw = kernel_west(b, w), be = kernel_east(b, w, words);
+            uint64_t cw = kernel_west(c, w), ce = kernel_east(c, w, words);
+
+            /* верхняя и нижняя тройки: полные сумматоры */
+            uint64_t t0 = aw ^ a[w] ^ ae;
+            uint64_t t1 = (aw & a[w]) | (ae & (aw ^ a[w]));
+            uint64_t u0 = cw ^ c[w] ^ ce;
+            uint64_t u1 = (cw & c[w]) | (ce & (cw ^ c[w]));
+            /* средняя пара: полусумматор */
+            uint64_t m0 = bw ^ be;
+            uint64_t m1 = bw & be;
+
+            /* разряд единиц */
+            uint64_t s0 = t0 ^ u0 ^ m0;
+            uint64_t c0 = (t0 & u0) | (m0 & (t0 ^ u0));
+            /* разряд двоек и признак "соседей не меньше четырех" */
+            uint64_t v0 = t1 ^ u1 ^ m1;
+            uint64_t v1 = (t1 & u1) | (m1 & (t1 ^ u1));
+            uint64_t s1 = v0 ^ c0;
+            uint64_t ge4 = v1 | (v0 & c0);
+
+            if (rule->conway) {
+                d[w] = s1 & ~ge4 & (s0 | b[w]);
+                continue;
+            }
+
+            /* разряды четверок и восьмерок для остальных правил */
+            uint64_t s[4] = {s0, s1, v1 ^ (v0 & c0), v1 & v0 & c0};
+            d[w] = kernel_bits_rule(rule, s, b[w]);
+        }
+
+        d[0] &= ~(uint64_t) 1;
+        d[words-1] &= tail;
+    }
+}
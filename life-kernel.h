@@ -0,0 +1,191 @@
+/**
+ * @file life-kernel.h
+ *
+ * Вычислительные ядра рабочего: построение очередного поколения для
+ * полосы "вселенной" в байтовом и в упакованном (битовом) представлении.
+ * Байтовое представление обрабатывается скалярно либо векторными
+ * инструкциями SSE2, AVX2 или AVX-512, выбираемыми по CPUID.
+ * Ядра не используют IPC и работают только с переданными им картами.
+ *
+ * Правило "вселенной" задается в записи B/S (например, "B36/S23") и
+ * компилируется в таблицы struct kernel_rule: скалярное ядро ищет новое
+ * состояние клетки по окрестности 3x3 в таблице из 512 элементов,
+ * векторные ядра AVX2 и AVX-512 — в таблицах по числу соседей,
+ * упакованное ядро сравнивает побитовую сумму соседей с масками правила.
+ */
+
+#ifndef LIFE_KERNEL_H
+#define LIFE_KERNEL_H
+
+#include <stdint.h>
+
+/** @brief число клеток в одном слове упакованной карты */
+#define KERNEL_WORD_BITS 64
+
+/** @brief байтовое ядро: клетка хранится как символ '*' / '.' */
+#define KERNEL_SCALAR 0
+/** @brief упакованное ядро: 64 клетки в одном слове uint64_t */
+#define KERNEL_BITS   1
+/** @brief байтовое ядро SSE2: 16 клеток за итерацию */
+#define KERNEL_SSE2   2
+/** @brief байтовое ядро AVX2: 32 клетки за итерацию */
+#define KERNEL_AVX2   3
+/** @brief байтовое ядро AVX-512BW: 64 клетки за итерацию */
+#define KERNEL_AVX512 4
+
+/** @brief правило игры "Жизнь" Конвея */
+#define KERNEL_RULE_CONWAY "B3/S23"
+/** @brief наибольшая длина записи правила вместе с нулевым байтом */
+#define KERNEL_RULE_SIZE 32
+
+/** @brief скомпилированное правило вида B/S */
+struct kernel_rule {
+    /** @brief бит n: мертвая клетка с n живыми соседями оживает */
+    uint16_t birth;
+    /** @brief бит n: живая клетка с n живыми соседями выживает */
+    uint16_t survive;
+    /** @brief правило совпадает с B3/S23 (упакованное ядро и SSE2 строят
+     * его без таблиц) */
+    int conway;
+    /** @brief новое состояние ('*' / '.') по окрестности 3x3: бит 3*k+r
+     * индекса — клетка столбца j+1-k и строки i-1+r */
+    char lut[512];
+    /** @brief 0xff, если мертвая клетка с n соседями оживает (n < 16) */
+    uint8_t birth_tab[16];
+    /** @brief 0xff, если живая клетка с n соседями выживает (n < 16) */
+    uint8_t survive_tab[16];
+};
+
+/**
+ * Выбрать самое быстрое байтовое ядро, поддерживаемое процессором.
+ *
+ * @return KERNEL_AVX512, KERNEL_AVX2, KERNEL_SSE2 или KERNEL_SCALAR
+ */
+int kernel_detect(void);
+
+/**
+ * Определить ядро по его имени ("auto", "scalar", "sse2", "avx2",
+ * "avx512", "bits"). Векторное ядро, не поддерживаемое процессором,
+ * заменяется на лучшее из доступных.
+ *
+ * @param[in] name имя ядра
+ * @return номер ядра или -1, если такого ядра нет
+ */
+int kernel_by_name(const char *name);
+
+/**
+ * Разобрать запись правила. Допускаются записи "B3/S23" (буквы в любом
+ * регистре, части в любом порядке) и "23/3" (сначала выживание, затем
+ * рождение).
+ *
+ * @param[in] text запись правила
+ * @param[out] birth маска рождения (бит n — n соседей)
+ * @param[out] survive маска выживания
+ * @return 0 при успехе, -1, если запись неверна
+ */
+int kernel_rule_parse(const char *text, uint16_t *birth, uint16_t *survive);
+
+/**
+ * Записать правило в каноническом виде "B.../S...".
+ *
+ * @param[in] birth маска рождения
+ * @param[in] survive маска выживания
+ * @param[out] text буфер не короче KERNEL_RULE_SIZE
+ */
+void kernel_rule_format(uint16_t birth, uint16_t survive, char *text);
+
+/**
+ * Скомпилировать правило в таблицы.
+ *
+ * @param[in] birth маска рождения
+ * @param[in] survive маска выживания
+ * @param[out] rule скомпилированное правило
+ */
+void kernel_rule_make(uint16_t birth, uint16_t survive, struct kernel_rule *rule);
+
+/**
+ * Построить очередное поколение в байтовом представлении без ветвлений.
+ *
+ * Клетки строк x0..x1 и столбцов y0..y1 карты curr вычисляются по карте
+ * prev; строки x0-1, x1+1 и столбцы y0-1, y1+1 карты prev должны быть
+ * заполнены. Вычисляемая область новой карты записывается полностью.
+ * Скалярное ядро проходит строку окном 3x3 по таблице rule->lut; SSE2
+ * строит без таблиц только правило Конвея, остальные правила — так же,
+ * как скалярное ядро.
+ *
+ * @param[in] k байтовое ядро (KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2,
+ * KERNEL_AVX512)
+ * @param[in] rule правило
+ * @param[in] prev карта последнего смоделированного поколения
+ * @param[out] curr карта нового поколения
+ * @param[in] x0 первая вычисляемая строка
+ * @param[in] x1 последняя вычисляемая строка
+ * @param[in] y0 первый вычисляемый столбец
+ * @param[in] y1 последний вычисляемый столбец
+ */
+void kernel_byte_step(int k, const struct kernel_rule *rule, char **prev, char **curr,
+                      int x0, int x1, int y0, int y1);
+
+/**
+ * Число слов, необходимое для хранения строки из n клеток.
+ *
+ * @param[in] n число клеток в строке
+ * @return число слов uint64_t
+ */
+int kernel_bits_words(int n);
+
+/**
+ * Упаковать строку из n клеток ('*' / '.') в слова.
+ *
+ * @param[in] src строка из символов
+ * @param[out] dst упакованная строка
+ * @param[in] n число клеток
+ */
+void kernel_pack_row(const char *src, uint64_t *dst, int n);
+
+/**
+ * Распаковать строку из n клеток, начиная с клетки first.
+ *
+ * @param[in] src упакованная строка
+ * @param[out] dst строка из символов
+ * @param[in] first номер первой клетки
+ * @param[in] n число клеток
+ */
+void kernel_unpack_row(const uint64_t *src, char *dst, int first, int n);
+
+/**
+ * Узнать состояние клетки упакованной строки.
+ *
+ * @param[in] row упакованная строка
+ * @param[in] j номер клетки
+ * @return '*' для живой клетки, '.' для мертвой
+ */
+char kernel_bits_get(const uint64_t *row, int j);
+
+/**
+ * Установить состояние клетки упакованной строки.
+ *
+ * @param[in] row упакованная строка
+ * @param[in] j номер клетки
+ * @param[in] c '*' для живой клетки, '.' для мертвой
+ */
+void kernel_bits_set(uint64_t *row, int j, char c);
+
+/**
+ * Построить очередное поколение в упакованном представлении.
+ *
+ * Клетки 1..n строк x0..x1 карты curr вычисляются по карте prev; строки
+ * x0-1 и x1+1 карты prev должны быть заполнены. Клетки 0 и n+1 каждой
+ * строки не вычисляются и в curr обнуляются.
+ *
+ * @param[in] rule правило
+ * @param[in] prev карта последнего смоделированного поколения
+ * @param[out] curr карта нового поколения
+ * @param[in] x0 первая вычисляемая строка
+ * @param[in] x1 последняя вычисляемая строка
+ * @param[in] n число вычисляемых клеток в строке
+ */
+void kernel_bits_step(const struct kernel_rule *rule, uint64_t **prev, uint64_t **curr,
+                      int x0, int x1, int n);
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file life-msg.c
+ *
+ * Отправка и прием сообщений протокола "life-msg.h" через очередь
+ * сообщений IPC.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include "life-msg.h"
+
+/** @brief сообщение очереди: заголовок и часть содержимого */
+struct msg_chunk {
+    /** @brief получатель */
+    long mtype;
+    /** @brief заголовок */
+    struct msg_head head;
+    /** @brief часть содержимого */
+    char data[MSG_CHUNK];
+};
+
+/**
+ * Подготовить буфер содержимого сообщения (с местом под завершающий
+ * нуль).
+ *
+ * @return 0 при успехе, -1 при нехватке памяти
+ */
+static int msg_reserve(struct life_msg *m, uint32_t len) {
+    if (len < m->cap) return 0;
+    char *data = realloc(m->data, len + 1);
+    if (!data) return -1;
+    m->data = data;
+    m->cap  = len + 1;
+    return 0;
+}
+
+int msg_send(int msgid, long mtype, int op, int prm1, int prm2, int seq, const void *data, uint32_t len) {
+    struct msg_chunk c;
+    uint32_t off = 0;
+
+    c.mtype        = mtype;
+    c.head.version = MSG_VERSION;
+    c.head.op      = op;
+    c.head.prm1    = prm1;
+    c.head.prm2    = prm2;
+    c.head.seq     = seq;
+
+    while (1) {
+        uint32_t n = (len - off > MSG_CHUNK) ? MSG_CHUNK: len - off;
+        c.head.flags = (off + n < len) ? MSG_MORE: 0;
+        c.head.len   = n;
+        if (n) memcpy(c.data, (const char *) data + off, n);
+
+        if (msgsnd(msgid, &c, sizeof(c.head) + n, 0) == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        off += n;
+        if (off == len) return 0;
+    }
+}
+
+int msg_recv(int msgid, long mtype, struct life_msg *m, int nowait) {
+    struct msg_chunk c;
+    int flags = MSG_NOERROR | ((nowait) ? IPC_NOWAIT: 0), first = 1;
+
+    m->len = 0;
+    do {
+        ssize_t r = msgrcv(msgid, &c, sizeof(c) - sizeof(long), mtype, flags);
+        if (r == -1) return -1;
+        if ((size_t) r < sizeof(c.head) || c.head.version != MSG_VERSION ||
+            c.head.len != (size_t) r - sizeof(c.head)) {
+            m->op  = 0;
+            errno  = EPROTO;
+            return -1;
+        }
+
+        if (first) {
+            m->op   = c.head.op;
+            m->prm1 = c.head.prm1;
+            m->prm2 = c.head.prm2;
+            m->seq  = c.head.seq;
+        }
+        if (msg_reserve(m, m->len + c.head.len) == -1) return -1;
+        memcpy(m->data + m->len, c.data, c.head.len);
+        m->len += c.head.len;
+        flags = MSG_NOERROR;
+        first = 0;
+    } while (c.head.flags & MSG_MORE);
+
+    m->data[m->len] = '\0';
+    return 0;
+}
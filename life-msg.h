@@ -0,0 +1,133 @@
+/**
+ * @file life-msg.h
+ *
+ * Протокол очереди сообщений клиента и сервера. Сообщение состоит из
+ * заголовка struct msg_head постоянной длины (версия, тип операции,
+ * параметры, номер команды, длина содержимого) и содержимого переменной
+ * длины: пути к файлу, записи правила, текста ответа или пачки клеток. В
+ * очередь кладется ровно столько байтов, сколько занимает сообщение,
+ * поэтому команда без содержимого и короткий ответ занимают десятки
+ * байтов. Содержимое длиннее MSG_CHUNK передается несколькими
+ * сообщениями очереди подряд: у всех, кроме последнего, выставлен флаг
+ * MSG_MORE, а получатель склеивает их. Сообщения с другой версией
+ * протокола отвергаются.
+ *
+ * Сервер отвечает на каждую команду одним сообщением с тем же op и seq, в
+ * содержимом которого лежит текст ответа ("OK" или "ERROR: ..."). В
+ * ответе на O_SNAP prm1 — номер буфера кадра, prm2 — номер поколения, а
+ * в тексте после "OK" — число отрезков изменений или "full", если клиент
+ * должен напечатать кадр целиком (см. "life-fb.h"). Сервер и рабочие
+ * обмениваются командами через кольца в разделяемой памяти (см.
+ * "life-ring.h").
+ */
+
+#ifndef LIFE_MSG_H
+#define LIFE_MSG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** @brief версия протокола */
+#define MSG_VERSION 1
+/** @brief флаг: за сообщением следует продолжение содержимого */
+#define MSG_MORE    1
+/** @brief наибольшая длина содержимого одного сообщения очереди */
+#define MSG_CHUNK   1024
+/** @brief наибольшая длина текста ответа на команду */
+#define MSG_REPLY   256
+/** @brief наибольшее число клеток в пачке O_CELLS */
+#define MSG_CELLS   1024
+/** @brief наибольшая длина строки ответа на одну клетку пачки (вместе с
+ * переводом строки) */
+#define MSG_LINE    64
+
+/** @brief заголовок сообщения */
+struct msg_head {
+    /** @brief версия протокола (MSG_VERSION) */
+    uint16_t version;
+    /** @brief флаги (MSG_MORE) */
+    uint16_t flags;
+    /** @brief тип операции */
+    int32_t op;
+    /** @brief первый параметр операции */
+    int32_t prm1;
+    /** @brief второй параметр операции */
+    int32_t prm2;
+    /** @brief номер команды клиента; сервер возвращает его в ответе, и
+     * клиент в пакетном режиме сопоставляет по нему ответы командам */
+    int32_t seq;
+    /** @brief длина содержимого этого сообщения очереди */
+    uint32_t len;
+};
+
+/** @brief клетка пачки O_CELLS */
+struct msg_cell {
+    /** @brief номер строки, с единицы */
+    int32_t x;
+    /** @brief номер столбца, с единицы */
+    int32_t y;
+    /** @brief 1 — добавить клетку, 0 — удалить */
+    int32_t alive;
+};
+
+/** @brief принятое сообщение */
+struct life_msg {
+    /** @brief тип операции */
+    int op;
+    /** @brief первый параметр операции */
+    int prm1;
+    /** @brief второй параметр операции */
+    int prm2;
+    /** @brief номер команды */
+    int seq;
+    /** @brief длина склеенного содержимого */
+    uint32_t len;
+    /** @brief содержимое, завершенное нулем (растущий буфер, принадлежит
+     * сообщению) */
+    char *data;
+    /** @brief размер буфера содержимого */
+    uint32_t cap;
+};
+
+/**
+ * Сколько байтов очереди займет сообщение с содержимым длины len (с
+ * заголовками всех его частей).
+ *
+ * @param[in] len длина содержимого
+ * @return число байтов
+ */
+static inline size_t msg_bytes(uint32_t len) {
+    size_t parts = (len) ? (len + MSG_CHUNK - 1) / MSG_CHUNK: 1;
+    return parts * sizeof(struct msg_head) + len;
+}
+
+/**
+ * Отправить сообщение, при необходимости разбив содержимое на части.
+ *
+ * @param[in] msgid идентификатор очереди
+ * @param[in] mtype получатель (pid_client или pid_server)
+ * @param[in] op тип операции
+ * @param[in] prm1 первый параметр операции
+ * @param[in] prm2 второй параметр операции
+ * @param[in] seq номер команды
+ * @param[in] data содержимое
+ * @param[in] len длина содержимого
+ * @return 0 при успехе, -1 при ошибке (код ошибки в errno)
+ */
+int msg_send(int msgid, long mtype, int op, int prm1, int prm2, int seq, const void *data, uint32_t len);
+
+/**
+ * Принять сообщение и склеить его содержимое. Флаг nowait относится
+ * только к первой части: остальные части отправитель кладет в очередь
+ * сразу за ней.
+ *
+ * @param[in] msgid идентификатор очереди
+ * @param[in] mtype получатель
+ * @param[in,out] m сообщение; буфер содержимого растет по мере надобности
+ * @param[in] nowait не ждать, если сообщений нет
+ * @return 0 при успехе, -1 при ошибке (код ошибки в errno; у сообщения
+ * другой версии op обнуляется, а errno равен EPROTO)
+ */
+int msg_recv(int msgid, long mtype, struct life_msg *m, int nowait);
+
+#endif
@@ -0,0 +1,297 @@
+/**
+ * @file life-net.c
+ *
+ * Кадры сообщений поверх TCP. Блокирующие функции дописывают и дочитывают
+ * кадр целиком; net_exchange() ведет для каждого соединения свое
+ * состояние приема и опрашивает сокеты через poll.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "life-net.h"
+
+/**
+ * Отключить алгоритм Нейгла: кадры короткие, и их нужно доставлять сразу.
+ *
+ * @param[in] fd сокет
+ */
+static void net_nodelay(int fd) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+int net_listen(int *port) {
+    struct sockaddr_in sa;
+    socklen_t size = sizeof(sa);
+    int on = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family      = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port        = htons(*port);
+    if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) == -1 || listen(fd, SOMAXCONN) == -1 ||
+        getsockname(fd, (struct sockaddr *) &sa, &size) == -1) {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(sa.sin_port);
+    return fd;
+}
+
+int net_accept(int fd, int timeout, char *host) {
+    struct pollfd p = {fd, POLLIN, 0};
+    struct sockaddr_in sa;
+    socklen_t size = sizeof(sa);
+
+    if (poll(&p, 1, timeout) != 1) return -1;
+    int c = accept(fd, (struct sockaddr *) &sa, &size);
+    if (c == -1) return -1;
+
+    net_nodelay(c);
+    if (host) inet_ntop(AF_INET, &sa.sin_addr, host, NET_HOST_SIZE);
+    return c;
+}
+
+int net_connect(const char *host, int port) {
+    struct addrinfo hints, *res;
+    char service[16];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    sprintf(service, "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd != -1 && connect(fd, res->ai_addr, res->ai_addrlen) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd != -1) net_nodelay(fd);
+    return fd;
+}
+
+int net_parse_addr(const char *addr, char *host, int *port) {
+    const char *colon = strrchr(addr, ':');
+    if (!colon || colon == addr || colon - addr >= NET_HOST_SIZE) return -1;
+    if (sscanf(colon + 1, "%d", port) != 1 || *port < 0 || *port > 65535) return -1;
+
+    memcpy(host, addr, colon - addr);
+    host[colon - addr] = '\0';
+    return 0;
+}
+
+/**
+ * Записать заголовок кадра в сетевом порядке байтов.
+ */
+static void net_pack(struct net_frame *h, int op, int prm1, int prm2, uint32_t len) {
+    h->op   = htonl(op);
+    h->prm1 = htonl(prm1);
+    h->prm2 = htonl(prm2);
+    h->len  = htonl(len);
+}
+
+/**
+ * Перевести заголовок кадра в порядок байтов узла.
+ */
+static void net_unpack(struct net_frame *h) {
+    h->op   = ntohl(h->op);
+    h->prm1 = ntohl(h->prm1);
+    h->prm2 = ntohl(h->prm2);
+    h->len  = ntohl(h->len);
+}
+
+/**
+ * Подготовить буфер содержимого сообщения.
+ *
+ * @return 0 при успехе, -1 при нехватке памяти
+ */
+static int net_reserve(struct net_msg *msg, uint32_t len) {
+    if (len <= msg->cap) return 0;
+    char *data = realloc(msg->data, len);
+    if (!data) return -1;
+    msg->data = data;
+    msg->cap  = len;
+    return 0;
+}
+
+int net_send(int fd, int op, int prm1, int prm2, const void *data, uint32_t len) {
+    struct net_frame h;
+    struct iovec iov[2];
+    net_pack(&h, op, prm1, prm2, len);
+
+    iov[0].iov_base = &h;
+    iov[0].iov_len  = sizeof(h);
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len  = len;
+
+    int n = 2;
+    struct iovec *v = iov;
+    while (n > 0) {
+        ssize_t w = writev(fd, v, n);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (n > 0 && (size_t) w >= v->iov_len) {
+            w -= v->iov_len;
+            v++;
+            n--;
+        }
+        if (n > 0) {
+            v->iov_base = (char *) v->iov_base + w;
+            v->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Прочитать ровно len байтов.
+ *
+ * @return 0 при успехе, -1 при ошибке или закрытом соединении
+ */
+static int net_read_all(int fd, void *buf, size_t len) {
+    char *p = (char *) buf;
+    while (len > 0) {
+        ssize_t r = read(fd, p, len);
+        if (r == -1 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p   += r;
+        len -= r;
+    }
+    return 0;
+}
+
+int net_recv(int fd, struct net_msg *msg) {
+    if (net_read_all(fd, &msg->hdr, sizeof(msg->hdr)) == -1) return -1;
+    net_unpack(&msg->hdr);
+    if (net_reserve(msg, msg->hdr.len) == -1) return -1;
+    return net_read_all(fd, msg->data, msg->hdr.len);
+}
+
+/**
+ * Дочитать из соединения то, что уже пришло. Каждый собранный кадр
+ * передается обработчику; из сокета не читается больше ожидаемых кадров.
+ *
+ * @return 0 при успехе, -1 при ошибке или закрытом соединении
+ */
+static int net_pull(struct net_in *in, void (*deliver)(const struct net_msg *msg, void *arg), void *arg) {
+    while (in->expect > 0) {
+        size_t head = sizeof(struct net_frame);
+        size_t need = (in->got < head) ? head: head + in->msg.hdr.len;
+        char *dst = (in->got < head) ? (char *) &in->msg.hdr + in->got: in->msg.data + (in->got - head);
+
+        if (in->got < need) {
+            ssize_t r = read(in->fd, dst, need - in->got);
+            if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+            if (r == -1 && errno == EINTR) continue;
+            if (r <= 0) return -1;
+            in->got += r;
+            if (in->got < need) continue;
+        }
+
+        if (need == head) {
+            net_unpack(&in->msg.hdr);
+            if (net_reserve(&in->msg, in->msg.hdr.len) == -1) return -1;
+            if (in->msg.hdr.len > 0) continue;
+        }
+
+        deliver(&in->msg, arg);
+        in->got = 0;
+        in->expect--;
+    }
+    return 0;
+}
+
+int net_exchange(const struct net_out *out, int nout, struct net_in *in, int nin,
+                 void (*deliver)(const struct net_msg *msg, void *arg), void *arg) {
+    struct pollfd p[nout + nin];
+    struct net_frame head[nout];
+    size_t sent[nout];
+    int next = 0, rc = 0;
+
+    for (int k = 0; k < nout; k++) {
+        net_pack(&head[k], out[k].op, out[k].prm1, 0, out[k].len);
+        sent[k] = 0;
+    }
+    for (int k = 0; k < nin; k++) in[k].got = 0;
+
+    while (rc == 0) {
+        int n = 0;
+        while (next < nout && sent[next] == sizeof(struct net_frame) + out[next].len) next++;
+
+        /* у каждого сокета отправляется первый недописанный кадр */
+        for (int k = next; k < nout; k++) {
+            int first = 1;
+            if (sent[k] == sizeof(struct net_frame) + out[k].len) continue;
+            for (int q = next; q < k; q++) {
+                if (out[q].fd == out[k].fd && sent[q] < sizeof(struct net_frame) + out[q].len) first = 0;
+            }
+            if (!first) continue;
+            p[n].fd = out[k].fd;
+            p[n].events = POLLOUT;
+            p[n++].revents = 0;
+        }
+        int nsend = n;
+        for (int k = 0; k < nin; k++) {
+            if (in[k].expect == 0) continue;
+            p[n].fd = in[k].fd;
+            p[n].events = POLLIN;
+            p[n++].revents = 0;
+        }
+        if (n == 0) break;
+
+        if (poll(p, n, -1) == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        for (int s = 0; s < nsend; s++) {
+            if (!(p[s].revents & (POLLOUT | POLLERR | POLLHUP))) continue;
+            int k = next;
+            while (out[k].fd != p[s].fd || sent[k] == sizeof(struct net_frame) + out[k].len) k++;
+
+            struct iovec iov[2];
+            int cnt = 0;
+            if (sent[k] < sizeof(struct net_frame)) {
+                iov[cnt].iov_base = (char *) &head[k] + sent[k];
+                iov[cnt++].iov_len = sizeof(struct net_frame) - sent[k];
+                iov[cnt].iov_base = (void *) out[k].data;
+                iov[cnt++].iov_len = out[k].len;
+            } else {
+                iov[cnt].iov_base = (char *) out[k].data + (sent[k] - sizeof(struct net_frame));
+                iov[cnt++].iov_len = sizeof(struct net_frame) + out[k].len - sent[k];
+            }
+            ssize_t w = writev(out[k].fd, iov, cnt);
+            if (w == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) rc = -1;
+            if (w > 0) sent[k] += w;
+        }
+
+        for (int s = nsend; s < n; s++) {
+            if (!p[s].revents) continue;
+            for (int k = 0; k < nin; k++) {
+                if (in[k].fd == p[s].fd && net_pull(&in[k], deliver, arg) == -1) rc = -1;
+            }
+        }
+    }
+    return rc;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file life-net.h
+ *
+ * Сетевой транспорт рабочих-процессов (ключ сервера "-n адрес:порт").
+ * Вместо колец, кадра и границ в разделяемой памяти сервер и рабочие
+ * обмениваются кадрами сообщений по TCP: заголовок struct net_frame
+ * (op, prm1, prm2 и длина содержимого в сетевом порядке байтов), за
+ * которым идет содержимое. Поэтому рабочие могут работать на других
+ * машинах; все узлы должны иметь одинаковый порядок байтов, так как
+ * содержимое (клетки, счетчики) передается как есть.
+ *
+ * Подключение:
+ *   -# рабочий подключается к серверу и отправляет NET_HELLO со своим
+ * номером и портом, на котором он ждет соседей;
+ *   -# сервер, дождавшись всех, отправляет каждому NET_INFO: размеры
+ * "вселенной", границы блоков и адреса всех рабочих;
+ *   -# рабочий подключается к соседям с меньшими номерами и принимает
+ * подключения соседей с большими (по одному соединению на пару), после
+ * чего подтверждает готовность.
+ *
+ * Команды сервера и подтверждения рабочих идут по соединению с сервером:
+ * подтверждение — кадр с op и prm1 команды, в котором для O_SNAP лежит
+ * блок, а для O_STATS — счетчики рабочего. Границы блоков рабочие
+ * отправляют соседям в начале каждого пакета поколений: op кадра — номер
+ * сегмента ореола получателя, prm1 = 0 означает, что граница не
+ * изменилась и содержимого нет.
+ */
+
+#ifndef LIFE_NET_H
+#define LIFE_NET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** @brief рабочий сообщает свой номер (prm1) и порт для соседей (prm2) */
+#define NET_HELLO 100
+/** @brief сервер сообщает размеры "вселенной" (prm1, prm2), границы
+ * блоков и адреса рабочих */
+#define NET_INFO  101
+/** @brief наибольшая длина имени узла */
+#define NET_HOST_SIZE 64
+/** @brief сколько сервер ждет подключения рабочих, мс */
+#define NET_ACCEPT_TIMEOUT 30000
+
+/** @brief заголовок кадра сообщения */
+struct net_frame {
+    /** @brief тип сообщения */
+    uint32_t op;
+    /** @brief первый параметр */
+    int32_t prm1;
+    /** @brief второй параметр */
+    int32_t prm2;
+    /** @brief длина содержимого в байтах */
+    uint32_t len;
+};
+
+/** @brief адрес рабочего в NET_INFO */
+struct net_addr {
+    /** @brief узел, с которого рабочий подключился к серверу */
+    char host[NET_HOST_SIZE];
+    /** @brief порт, на котором рабочий ждет соседей */
+    int32_t port;
+};
+
+/** @brief принятое сообщение */
+struct net_msg {
+    /** @brief заголовок (в порядке байтов узла) */
+    struct net_frame hdr;
+    /** @brief содержимое (растущий буфер, принадлежит сообщению) */
+    char *data;
+    /** @brief размер буфера содержимого */
+    uint32_t cap;
+};
+
+/** @brief отправляемый кадр для net_exchange() */
+struct net_out {
+    /** @brief сокет */
+    int fd;
+    /** @brief тип сообщения */
+    int op;
+    /** @brief первый параметр */
+    int prm1;
+    /** @brief содержимое */
+    const void *data;
+    /** @brief длина содержимого */
+    uint32_t len;
+};
+
+/** @brief соединение, из которого net_exchange() принимает кадры */
+struct net_in {
+    /** @brief сокет */
+    int fd;
+    /** @brief сколько кадров ожидается */
+    int expect;
+    /** @brief принимаемое сообщение */
+    struct net_msg msg;
+    /** @brief сколько байтов текущего кадра (заголовок и содержимое)
+     * уже принято */
+    size_t got;
+};
+
+/**
+ * Открыть сокет, ожидающий подключений на всех адресах узла.
+ *
+ * @param[in,out] port порт (0 — любой свободный; тогда в port
+ * записывается выбранный)
+ * @return сокет или -1
+ */
+int net_listen(int *port);
+
+/**
+ * Принять подключение, ожидая не дольше timeout мс.
+ *
+ * @param[in] fd ожидающий сокет
+ * @param[in] timeout время ожидания, мс (-1 — без ограничения)
+ * @param[out] host узел, с которого подключились (NET_HOST_SIZE байт),
+ * или NULL
+ * @return сокет соединения или -1
+ */
+int net_accept(int fd, int timeout, char *host);
+
+/**
+ * Подключиться к узлу.
+ *
+ * @param[in] host имя или адрес узла
+ * @param[in] port порт
+ * @return сокет соединения или -1
+ */
+int net_connect(const char *host, int port);
+
+/**
+ * Разобрать адрес "узел:порт".
+ *
+ * @param[in] addr адрес
+ * @param[out] host узел (NET_HOST_SIZE байт)
+ * @param[out] port порт
+ * @return 0 при успехе, -1 при ошибке
+ */
+int net_parse_addr(const char *addr, char *host, int *port);
+
+/**
+ * Отправить кадр целиком, дожидаясь записи.
+ *
+ * @param[in] fd сокет
+ * @param[in] op тип сообщения
+ * @param[in] prm1 первый параметр
+ * @param[in] prm2 второй параметр
+ * @param[in] data содержимое
+ * @param[in] len длина содержимого
+ * @return 0 при успехе, -1 при ошибке
+ */
+int net_send(int fd, int op, int prm1, int prm2, const void *data, uint32_t len);
+
+/**
+ * Принять кадр целиком, дожидаясь его.
+ *
+ * @param[in] fd сокет
+ * @param[in,out] msg сообщение; буфер содержимого растет по мере надобности
+ * @return 0 при успехе, -1 при ошибке или закрытом соединении
+ */
+int net_recv(int fd, struct net_msg *msg);
+
+/**
+ * Одновременно отправить и принять кадры по нескольким соединениям
+ * (сокеты должны быть неблокирующими). Передача и прием чередуются по
+ * мере готовности сокетов, поэтому рабочие, отправляющие друг другу
+ * границы, не блокируют друг друга при заполненных буферах сокетов. Кадры
+ * для одного сокета отправляются в порядке массива out.
+ *
+ * @param[in] out отправляемые кадры
+ * @param[in] nout число отправляемых кадров
+ * @param[in,out] in соединения, из которых принимаются кадры
+ * @param[in] nin число соединений
+ * @param[in] deliver обработчик каждого принятого кадра
+ * @param[in] arg параметр обработчика
+ * @return 0 при успехе, -1 при ошибке
+ */
+int net_exchange(const struct net_out *out, int nout, struct net_in *in, int nin,
+                 void (*deliver)(const struct net_msg *msg, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,257 @@
+/**
+ * @file life-pattern.c
+ *
+ * Разбор образцов в форматах RLE, Life 1.06 и plaintext. Файл читается
+ * в память целиком, живые клетки складываются в растущий массив.
+ * Запись RLE выполняется через буферизованный вывод stdio.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include "life-pattern.h"
+
+/** @brief растущий массив живых клеток */
+struct pattern_list {
+    /** @brief клетки */
+    struct pattern_cell *cell;
+    /** @brief число клеток */
+    long count;
+    /** @brief размер выделенной памяти (в клетках) */
+    long size;
+};
+
+/**
+ * Добавить клетку в массив.
+ *
+ * @param[in,out] list массив клеток
+ * @param[in] x номер строки
+ * @param[in] y номер столбца
+ * @return 0 при успехе, -1 при нехватке памяти
+ */
+static int pattern_push(struct pattern_list *list, int x, int y) {
+    if (list->count == list->size) {
+        long size = (list->size) ? 2*list->size: 1024;
+        struct pattern_cell *cell = realloc(list->cell, size * sizeof(struct pattern_cell));
+        if (!cell) return -1;
+        list->cell = cell;
+        list->size = size;
+    }
+    list->cell[list->count].x = x;
+    list->cell[list->count].y = y;
+    list->count++;
+    return 0;
+}
+
+/**
+ * Прочитать файл в память целиком.
+ *
+ * @param[in] path путь к файлу
+ * @return строка с содержимым файла (освобождается через free) или NULL
+ */
+static char *pattern_slurp(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *text = (size >= 0) ? malloc(size + 1): NULL;
+    if (text && fread(text, 1, size, f) != (size_t) size) {
+        free(text);
+        text = NULL;
+    }
+    if (text) text[size] = '\0';
+    fclose(f);
+    return text;
+}
+
+/**
+ * Перейти к началу следующей строки.
+ *
+ * @param[in] s текущая позиция
+ * @return начало следующей строки (или конец текста)
+ */
+static char *pattern_next_line(char *s) {
+    while (*s && *s != '\n') s++;
+    return (*s) ? s+1: s;
+}
+
+/**
+ * Разобрать тело RLE, начиная со строки после заголовка. Серия без
+ * числа имеет длину 1; 'b' и '.' — мертвые клетки, '$' — конец строки,
+ * '!' — конец образца, остальные буквы считаются живыми клетками. Серии,
+ * уводящие строку или столбец за INT_MAX, считаются ошибкой.
+ */
+static int pattern_rle(char *s, struct pattern_list *list) {
+    int x = 0, y = 0;
+    long run = 0;
+
+    for (; *s && *s != '!'; s++) {
+        if (isdigit((unsigned char) *s)) {
+            run = 10*run + (*s - '0');
+            if (run > INT_MAX) return -1;
+            continue;
+        }
+        if (isspace((unsigned char) *s)) continue;
+        if (*s == '#') {
+            s = pattern_next_line(s) - 1;
+            continue;
+        }
+
+        long n = (run) ? run: 1;
+        run = 0;
+
+        if (*s == '$') {
+            if (n > INT_MAX - x) return -1;
+            x += n;
+            y = 0;
+        } else if (*s == 'b' || *s == '.') {
+            if (n > INT_MAX - y) return -1;
+            y += n;
+        } else if (isalpha((unsigned char) *s)) {
+            if (n > INT_MAX - y) return -1;
+            for (long k = 0; k < n; k++) {
+                if (pattern_push(list, x, y++) == -1) return -1;
+            }
+        } else return -1;
+    }
+    return 0;
+}
+
+/**
+ * Разобрать Life 1.06: каждая строка, кроме комментариев, содержит пару
+ * "столбец строка". Координаты, не помещающиеся в int, считаются
+ * ошибкой.
+ */
+static int pattern_life106(char *s, struct pattern_list *list) {
+    for (; *s; s = pattern_next_line(s)) {
+        while (*s == ' ' || *s == '\t' || *s == '\r') s++;
+        if (*s == '#' || *s == '\n' || *s == '\0') continue;
+
+        char *end, *next;
+        long y = strtol(s, &end, 10);
+        long x = strtol(end, &next, 10);
+        if (end == s || next == end) return -1;
+        if (x < INT_MIN || x > INT_MAX || y < INT_MIN || y > INT_MAX) return -1;
+        if (pattern_push(list, x, y) == -1) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Разобрать plaintext: каждая строка, кроме комментариев с '!', — строка
+ * образца, 'O' и '*' обозначают живые клетки.
+ */
+static int pattern_plain(char *s, struct pattern_list *list) {
+    for (int x = 0; *s; s = pattern_next_line(s)) {
+        if (*s == '!') continue;
+
+        for (int y = 0; s[y] && s[y] != '\n'; y++) {
+            if (s[y] == 'O' || s[y] == '*') {
+                if (pattern_push(list, x, y) == -1) return -1;
+            }
+        }
+        x++;
+    }
+    return 0;
+}
+
+struct pattern_cell *pattern_read(const char *path, long *count) {
+    char *text = pattern_slurp(path);
+    if (!text) return NULL;
+
+    struct pattern_list list = {NULL, 0, 0};
+    int rc, absolute = 0;
+
+    char *s = text;
+    while (*s == '#' && strncmp(s, "#Life 1.06", 10) != 0) s = pattern_next_line(s);
+
+    if (strncmp(s, "#Life 1.06", 10) == 0) {
+        rc = pattern_life106(pattern_next_line(s), &list);
+        absolute = 1;
+    } else {
+        char *h = s;
+        while (*h == ' ' || *h == '\t') h++;
+        int width;
+        if (sscanf(h, "x = %d", &width) == 1) {
+            rc = pattern_rle(pattern_next_line(h), &list);
+        } else rc = pattern_plain(s, &list);
+    }
+    free(text);
+
+    if (rc == -1) {
+        free(list.cell);
+        return NULL;
+    }
+
+    if (absolute && list.count) {
+        int x0 = list.cell[0].x, y0 = list.cell[0].y;
+        for (long i = 1; i < list.count; i++) {
+            if (list.cell[i].x < x0) x0 = list.cell[i].x;
+            if (list.cell[i].y < y0) y0 = list.cell[i].y;
+        }
+        for (long i = 0; i < list.count; i++) {
+            if ((long) list.cell[i].x - x0 > INT_MAX || (long) list.cell[i].y - y0 > INT_MAX) {
+                free(list.cell);
+                return NULL;
+            }
+        }
+        for (long i = 0; i < list.count; i++) {
+            list.cell[i].x -= x0;
+            list.cell[i].y -= y0;
+        }
+    }
+    if (!list.cell) list.cell = malloc(sizeof(struct pattern_cell));
+
+    *count = list.count;
+    return list.cell;
+}
+
+/**
+ * Записать отрезок RLE, перенося строку перед 70-м символом.
+ *
+ * @param[in] f файл
+ * @param[in,out] width число символов в текущей строке файла
+ * @param[in] count длина отрезка
+ * @param[in] tag символ отрезка ('b', 'o', '$' или '!')
+ */
+static void pattern_put_run(FILE *f, int *width, long count, char tag) {
+    char run[24];
+    int len = (count > 1) ? sprintf(run, "%ld%c", count, tag): sprintf(run, "%c", tag);
+    if (*width + len > 70) {
+        fputc('\n', f);
+        *width = 0;
+    }
+    fputs(run, f);
+    *width += len;
+}
+
+void pattern_write_rle(FILE *f, const char *cells, int rows, int cols, const char *rule) {
+    int width = 0;
+    long rows_skipped = 0;
+
+    fprintf(f, "x = %d, y = %d, rule = %s\n", cols, rows, rule);
+    for (int x = 0; x < rows; x++) {
+        const char *row = cells + (size_t) x * cols;
+        int end = cols;
+        while (end > 0 && row[end-1] != '*') end--;
+
+        if (x > 0) rows_skipped++;
+        if (end == 0) continue;
+        if (rows_skipped) pattern_put_run(f, &width, rows_skipped, '$');
+        rows_skipped = 0;
+
+        for (int y = 0; y < end; ) {
+            int len = 1;
+            while (y + len < end && row[y+len] == row[y]) len++;
+            pattern_put_run(f, &width, len, (row[y] == '*') ? 'o': 'b');
+            y += len;
+        }
+    }
+    pattern_put_run(f, &width, 1, '!');
+    fputc('\n', f);
+}
@@ -0,0 +1,52 @@
+/**
+ * @file life-pattern.h
+ *
+ * Чтение образцов "вселенной" из файлов стандартных форматов:
+ *   - RLE ("x = m, y = n, rule = ..." и строки вида "bo$2bo$3o!");
+ *   - Life 1.06 (первая строка "#Life 1.06", затем пары "столбец строка");
+ *   - plaintext ".cells" (строки из 'O' и '.', комментарии с '!').
+ * Модуль не использует IPC и только перечисляет живые клетки образца.
+ * Кроме того, карту клеток можно записать в формате RLE (для потока
+ * кадров, см. "life-stream.h").
+ */
+
+#ifndef LIFE_PATTERN_H
+#define LIFE_PATTERN_H
+
+#include <stdio.h>
+
+/** @brief живая клетка образца */
+struct pattern_cell {
+    /** @brief номер строки относительно верхней строки образца */
+    int x;
+    /** @brief номер столбца относительно левого столбца образца */
+    int y;
+};
+
+/**
+ * Прочитать образец из файла. Формат определяется по содержимому.
+ * Координаты отсчитываются от левого верхнего угла образца с нуля; в
+ * Life 1.06 координаты абсолютные, поэтому они сдвигаются так, чтобы
+ * наименьшие номер строки и номер столбца были равны нулю.
+ *
+ * @param[in] path путь к файлу
+ * @param[out] count число живых клеток
+ * @return массив живых клеток (освобождается вызывающим через free) или
+ * NULL, если файл не удалось прочитать или разобрать
+ */
+struct pattern_cell *pattern_read(const char *path, long *count);
+
+/**
+ * Записать карту клеток в формате RLE: строку "x = cols, y = rows, rule
+ * = ..." и отрезки клеток, строки не длиннее 70 символов. Мертвые клетки
+ * в конце строк и пустые строки в конце карты не записываются.
+ *
+ * @param[in] f файл
+ * @param[in] cells карта rows x cols ('*' / '.'), строки подряд
+ * @param[in] rows число клеток по вертикали
+ * @param[in] cols число клеток по горизонтали
+ * @param[in] rule правило в записи B/S
+ */
+void pattern_write_rle(FILE *f, const char *cells, int rows, int cols, const char *rule);
+
+#endif
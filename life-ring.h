@@ -0,0 +1,288 @@
+/**
+ * @file life-ring.h
+ *
+ * Управляющий канал между сервером и рабочими. Сервер и рабочие
+ * разделяют один сегмент памяти, в котором лежат:
+ *   -# заголовок struct life_ctl со счетчиком выполненных команд;
+ *   -# по одному кольцу команд struct ring на рабочего (один писатель —
+ * сервер, один читатель — рабочий);
+ *   -# границы рядов и колонок блоков (K+1 и K+1 чисел), которые сервер
+ * меняет при перебалансировке;
+ *   -# K+1 структур счетчиков struct life_stats (по одной на рабочего и
+ * одна для сервера, см. "life-stats.h").
+ *
+ * Ожидание реализовано через futex: пока очередь команд не пуста или
+ * счетчик подтверждений не достиг нужного значения, системные вызовы не
+ * выполняются. Так же устроены семафоры границ рабочих-потоков
+ * (struct fsem), заменяющие семафоры SysV в многопоточном режиме.
+ */
+
+#ifndef LIFE_RING_H
+#define LIFE_RING_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "life-stats.h"
+
+/** @brief число команд в кольце */
+#define RING_SIZE 64
+/** @brief число попыток опроса перед засыпанием на futex */
+#define RING_SPINS 64
+/** @brief наибольшая длина пути к файлу, передаваемого рабочим */
+#define CTL_PATH_SIZE 4096
+
+/** @brief команда, передаваемая рабочему через кольцо */
+struct ring_cmd {
+    /** @brief тип команды (O_ADD, O_START, ...) */
+    int op;
+    /** @brief первый параметр операции */
+    int prm1;
+    /** @brief второй параметр операции */
+    int prm2;
+};
+
+/** @brief кольцо команд одного рабочего */
+struct ring {
+    /** @brief число записанных команд (изменяет только сервер) */
+    uint32_t head __attribute__((aligned(64)));
+    /** @brief признак того, что рабочий спит на futex head */
+    uint32_t sleeping;
+    /** @brief число прочитанных команд (изменяет только рабочий) */
+    uint32_t tail __attribute__((aligned(64)));
+    /** @brief суммарное время построения поколений рабочим, нс
+     * (изменяет только рабочий) */
+    uint64_t busy;
+    /** @brief команды */
+    struct ring_cmd cmd[RING_SIZE];
+};
+
+/** @brief заголовок управляющего сегмента */
+struct life_ctl {
+    /** @brief число клеток "вселенной" по вертикали */
+    int rows;
+    /** @brief число клеток "вселенной" по горизонтали */
+    int cols;
+    /** @brief число рабочих */
+    int workers;
+    /** @brief путь к файлу для команд O_SAVE и O_RESTORE */
+    char path[CTL_PATH_SIZE];
+    /** @brief барьер: общее число выполненных рабочими команд */
+    uint32_t acks __attribute__((aligned(64)));
+    /** @brief признак того, что сервер спит на futex acks */
+    uint32_t waiting;
+};
+
+/**
+ * Размер управляющего сегмента.
+ *
+ * @param[in] workers число рабочих
+ * @return размер в байтах
+ */
+static inline size_t ctl_size(int workers) {
+    size_t head = sizeof(struct life_ctl) + workers * sizeof(struct ring) + 2 * (workers+1) * sizeof(int);
+    head = (head + 63) / 64 * 64;
+    return head + (workers+1) * sizeof(struct life_stats);
+}
+
+/**
+ * Кольцо команд рабочего.
+ *
+ * @param[in] ctl управляющий сегмент
+ * @param[in] i номер рабочего
+ * @return указатель на кольцо
+ */
+static inline struct ring *ctl_ring(struct life_ctl *ctl, int i) {
+    return (struct ring *) (ctl + 1) + i;
+}
+
+/**
+ * Границы рядов блоков: ряд r занимает строки row_split[r]..row_split[r+1]-1
+ * (считая с нуля), row_split[Py] равно числу строк "вселенной".
+ *
+ * @param[in] ctl управляющий сегмент
+ * @return массив из Py+1 чисел
+ */
+static inline int *ctl_row_split(struct life_ctl *ctl) {
+    return (int *) ctl_ring(ctl, ctl->workers);
+}
+
+/**
+ * Границы колонок блоков (аналогично ctl_row_split()).
+ *
+ * @param[in] ctl управляющий сегмент
+ * @return массив из Px+1 чисел
+ */
+static inline int *ctl_col_split(struct life_ctl *ctl) {
+    return ctl_row_split(ctl) + ctl->workers + 1;
+}
+
+/**
+ * Счетчики рабочего или сервера. Они лежат после границ блоков,
+ * выровненными по 64 байтам.
+ *
+ * @param[in] ctl управляющий сегмент
+ * @param[in] i номер рабочего (ctl->workers — счетчики сервера)
+ * @return указатель на счетчики
+ */
+static inline struct life_stats *ctl_stats(struct life_ctl *ctl, int i) {
+    uintptr_t p = (uintptr_t) (ctl_col_split(ctl) + ctl->workers + 1);
+    return (struct life_stats *) ((p + 63) / 64 * 64) + i;
+}
+
+/**
+ * Заснуть, пока значение по адресу равно val.
+ *
+ * @param[in] addr адрес слова в разделяемой памяти
+ * @param[in] val ожидаемое значение
+ */
+static inline void futex_wait(uint32_t *addr, uint32_t val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+/**
+ * Разбудить всех, кто спит на данном адресе.
+ *
+ * @param[in] addr адрес слова в разделяемой памяти
+ */
+static inline void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/** @brief семафор на futex для границ рабочих-потоков */
+struct fsem {
+    /** @brief значение семафора */
+    uint32_t count;
+    /** @brief признак того, что владелец границы спит на futex count */
+    uint32_t waiting;
+};
+
+/**
+ * Поднять семафор на единицу (вызывается читателем границы).
+ *
+ * @param[in] s семафор
+ */
+static inline void fsem_up(struct fsem *s) {
+    __atomic_add_fetch(&s->count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&s->count);
+}
+
+/**
+ * Опустить семафор на n, дождавшись, пока его значение станет не меньше
+ * n (вызывается единственным владельцем границы).
+ *
+ * @param[in] s семафор
+ * @param[in] n на сколько опустить семафор
+ */
+static inline void fsem_down(struct fsem *s, uint32_t n) {
+    uint32_t v;
+
+    for (int spin = 0; (v = __atomic_load_n(&s->count, __ATOMIC_ACQUIRE)) < n; spin++) {
+        if (spin < RING_SPINS) continue;
+
+        __atomic_store_n(&s->waiting, 1, __ATOMIC_SEQ_CST);
+        v = __atomic_load_n(&s->count, __ATOMIC_SEQ_CST);
+        if (v < n) futex_wait(&s->count, v);
+        __atomic_store_n(&s->waiting, 0, __ATOMIC_SEQ_CST);
+    }
+    __atomic_sub_fetch(&s->count, n, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Опустить семафор на n, если его значение уже не меньше n (вызывается
+ * единственным владельцем границы).
+ *
+ * @param[in] s семафор
+ * @param[in] n на сколько опустить семафор
+ * @return 1, если семафор опущен, иначе 0
+ */
+static inline int fsem_trydown(struct fsem *s, uint32_t n) {
+    if (__atomic_load_n(&s->count, __ATOMIC_ACQUIRE) < n) return 0;
+    __atomic_sub_fetch(&s->count, n, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+/**
+ * Записать команду в кольцо рабочего (вызывается сервером).
+ *
+ * @param[in] r кольцо
+ * @param[in] op тип команды
+ * @param[in] p1 первый параметр
+ * @param[in] p2 второй параметр
+ */
+static inline void ring_push(struct ring *r, int op, int p1, int p2) {
+    uint32_t head = r->head;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= RING_SIZE)
+        sched_yield();
+
+    struct ring_cmd *c = &r->cmd[head % RING_SIZE];
+    c->op   = op;
+    c->prm1 = p1;
+    c->prm2 = p2;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&r->sleeping, __ATOMIC_SEQ_CST))
+        futex_wake(&r->head);
+}
+
+/**
+ * Прочитать очередную команду из кольца, при необходимости дождавшись
+ * ее (вызывается рабочим).
+ *
+ * @param[in] r кольцо
+ * @return команда
+ */
+static inline struct ring_cmd ring_pop(struct ring *r) {
+    uint32_t tail = r->tail;
+
+    for (int spin = 0; __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail; spin++) {
+        if (spin < RING_SPINS) continue;
+
+        __atomic_store_n(&r->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == tail)
+            futex_wait(&r->head, tail);
+        __atomic_store_n(&r->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    struct ring_cmd c = r->cmd[tail % RING_SIZE];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return c;
+}
+
+/**
+ * Подтвердить выполнение команды (вызывается рабочим).
+ *
+ * @param[in] ctl управляющий сегмент
+ */
+static inline void ctl_ack(struct life_ctl *ctl) {
+    __atomic_add_fetch(&ctl->acks, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ctl->waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&ctl->acks);
+}
+
+/**
+ * Дождаться, пока счетчик подтверждений достигнет значения target
+ * (вызывается сервером).
+ *
+ * @param[in] ctl управляющий сегмент
+ * @param[in] target ожидаемое значение счетчика
+ */
+static inline void ctl_wait_acks(struct life_ctl *ctl, uint32_t target) {
+    uint32_t acks;
+
+    for (int spin = 0; (int32_t) ((acks = __atomic_load_n(&ctl->acks, __ATOMIC_ACQUIRE)) - target) < 0; spin++) {
+        if (spin < RING_SPINS) continue;
+
+        __atomic_store_n(&ctl->waiting, 1, __ATOMIC_SEQ_CST);
+        acks = __atomic_load_n(&ctl->acks, __ATOMIC_SEQ_CST);
+        if ((int32_t) (acks - target) < 0)
+            futex_wait(&ctl->acks, acks);
+        __atomic_store_n(&ctl->waiting, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+#endif
@@ -7,6 +7,22 @@
  */
 
 #include "life.h"
+#include "life-ring.h"
+#include "life-fb.h"
+#include "life-kernel.h"
+#include "life-pattern.h"
+#include "life-ckpt.h"
+#include "life-worker.h"
+#include "life-hash.h"
+#include "life-chunk.h"
+#include "life-stream.h"
+#include "life-net.h"
+#include "life-msg.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
 
 /** @brief число клеток во "вселенной" по горизонтали*/
 int N;
@@ -16,6 +32,8 @@ int M;
 int K;
 
 FILE *logfile;
+/** @brief команда клиента, которую сервер выполняет сейчас*/
+struct life_msg request;
 
 /** @brief идентификатор процесса-сервера*/
 pid_t  pid_server = 0;
@@ -23,8 +41,10 @@ pid_t  pid_server = 0;
 pid_t  pid_client = 0;
 /** @brief массив идентификаторов процессов-рабочих*/
 pid_t *pid_worker;
-/** @brief карта распараллеливания столбцов "вселенной" между рабочими*/
-int  *pid_worker_map;
+/** @brief карта распараллеливания строк "вселенной" по рядам блоков*/
+int  *pid_worker_map_row;
+/** @brief карта распараллеливания столбцов "вселенной" по колонкам блоков*/
+int  *pid_worker_map_col;
 
 /** @brief IPC ключ для очереди сообщений, семафоров и разделяемой памяти*/
 key_t key;
@@ -34,181 +54,789 @@ int   msgid;
  * разделяемой памяти*/
 int  *semid;
 /** @brief массив идентификаторов разделяемой памяти для каждой из
- * границ областей "вселенной"*/
+ * границ областей "вселенной" (по четыре на рабочего: левая, правая,
+ * верхняя и нижняя)*/
 int  *shmid;
-/** @brief ширина одной полосы*/
-int   width;
+/** @brief число рядов блоков*/
+int   Py = 1;
+/** @brief число колонок блоков*/
+int   Px = 1;
 /** @brief число поколений, которых предстоит еще построить*/
 int   steps = 0;
-/** @brief число уведомлений, пришедших от рабочих*/
-int counter = 0;
+/** @brief клиент ждет окончания моделирования (команда O_WAIT)*/
+int   client_waiting = 0;
+/** @brief номер команды O_WAIT, на которую сервер ответит по окончании
+ * моделирования*/
+int   client_waiting_seq = 0;
+/** @brief наибольшее число правок клеток, которые сервер копит перед
+ * отправкой рабочим*/
+#define EDIT_BATCH 1024
+/** @brief правка клетки, ждущая отправки рабочему*/
+struct server_edit {
+    /** @brief номер рабочего*/
+    int worker;
+    /** @brief O_ADD или O_DEL*/
+    int op;
+    /** @brief номер строки (в координатах рабочего)*/
+    int x;
+    /** @brief номер столбца (в координатах рабочего)*/
+    int y;
+};
+/** @brief накопленные правки клеток*/
+struct server_edit edit[EDIT_BATCH];
+/** @brief число накопленных правок клеток*/
+int   edits_pending = 0;
+/** @brief идентификатор управляющего сегмента*/
+int   ctlid;
+/** @brief управляющий сегмент с кольцами команд рабочих*/
+struct life_ctl *ctl;
+/** @brief идентификатор сегмента кадра для скриншотов*/
+int   fbid;
+/** @brief общий кадр "вселенной" (два буфера)*/
+struct life_fb *fb;
+/** @brief число построенных поколений*/
+int64_t generation = 0;
+/** @brief значение счетчика подтверждений, после которого все
+ * отправленные рабочим команды выполнены*/
+uint32_t acks_expected = 0;
+/** @brief имя вычислительного ядра рабочих*/
+char *kernel_name = "auto";
+/** @brief глубина ореола (в строках и столбцах) и наибольшее число
+ * поколений, которые рабочие строят без обмена границами*/
+int   G = 1;
+/** @brief маска рождения текущего правила (бит n — n соседей)*/
+uint16_t rule_birth = 1 << 3;
+/** @brief маска выживания текущего правила*/
+uint16_t rule_survive = (1 << 2) | (1 << 3);
+
+/** @brief файлы, по которым строятся IPC-ключи границ рабочих*/
+char *border_file[4] = {"worker-left", "worker-right", "worker-top", "worker-bottom"};
+/** @brief режим выполнения: 0 — рабочие-процессы, 1 — рабочие-потоки*/
+int   threaded = 0;
+/** @brief массив рабочих-потоков*/
+pthread_t *thread;
+/** @brief параметры рабочих-потоков*/
+struct worker_arg *thread_arg;
+/** @brief границы рабочих-потоков (по четыре на рабочего)*/
+char **band;
+/** @brief семафоры границ рабочих-потоков*/
+struct fsem *band_sem;
+/** @brief границы рядов блоков (Py+1 чисел в управляющем сегменте)*/
+int  *row_split;
+/** @brief границы колонок блоков (Px+1 чисел в управляющем сегменте)*/
+int  *col_split;
+/** @brief период перебалансировки в поколениях (0 — не балансировать)*/
+int   balance = 0;
+/** @brief число поколений, построенных после последней перебалансировки*/
+int   balance_gens = 0;
+/** @brief через сколько поколений (не больше) сервер сравнивает хеши
+ * "вселенной" при поиске циклов (0 — не искать циклы)*/
+int   cycle_every = 8;
+/** @brief значения счетчиков busy рабочих при последней перебалансировке*/
+uint64_t *busy_seen;
+/** @brief счетчики этапов сервера в управляющем сегменте*/
+struct life_stats *stats;
+/** @brief поколения строят рабочие на картах блоков*/
+#define ENGINE_GRID     0
+/** @brief поколения строит сервер алгоритмом HashLife*/
+#define ENGINE_HASHLIFE 1
+/** @brief рабочие строят поколения неограниченной разреженной "вселенной"*/
+#define ENGINE_SPARSE   2
+/** @brief способ построения поколений (ключ "-e")*/
+int   engine = ENGINE_GRID;
+/** @brief память узлов HashLife*/
+struct hash_life hash;
+/** @brief идентификатор сегмента чанков разреженной "вселенной"*/
+int   chunksid;
+/** @brief сегмент чанков разреженной "вселенной" (см. "life-chunk.h")*/
+struct life_chunks *chunks = NULL;
+/** @brief поток кадров (команда "stream")*/
+struct life_stream stream;
+/** @brief адрес "узел:порт", по которому рабочие подключаются к серверу
+ * (ключ "-n"), или NULL, если используется разделяемая память*/
+char *net_addr = NULL;
+/** @brief файл с командами запуска рабочих на других узлах (ключ "-H")*/
+char *net_hosts = NULL;
+/** @brief соединения с рабочими при сетевом транспорте*/
+int  *net_fd = NULL;
+/** @brief число неподтвержденных команд каждого рабочего*/
+int  *net_pending = NULL;
+/** @brief последнее подтверждение рабочего вместе с данными*/
+struct net_msg net_reply;
+/** @brief значение "steps", при котором моделирование идет до команды
+ * O_STOP*/
+#define STEPS_ENDLESS INT_MAX
+/** @brief наибольшее число принятых, но еще не выполненных команд
+ * клиента*/
+#define INBOX_SIZE 64
+/** @brief число запоминаемых хешей "вселенной" при поиске циклов*/
+#define CYCLE_HISTORY 64
+
+/**
+ * @brief поиск циклов
+ *
+ * После пакета поколений (одного из нескольких, чтобы между хешами было
+ * не больше cycle_every поколений) сервер собирает хеш "вселенной" из
+ * хешей блоков, которые считают рабочие, и ищет его среди последних
+ * CYCLE_HISTORY хешей. Совпадение на расстоянии P поколений значит, что
+ * "вселенная" вошла в цикл, период которого делит P (между концами
+ * пакетов длины G видны только расстояния, кратные G). Сервер
+ * пропускает целое число раз по P поколений, оставляя от P до 2P-1, и
+ * строит оставшиеся по одному поколению, пока хеш не повторится: так
+ * находится точный период p, после чего пропускается и целое число
+ * периодов p. Поколения, которые остались после этого, строятся обычным
+ * образом, поэтому итог совпадает с полным моделированием. Хеши блоков
+ * зависят от их границ, поэтому перебалансировка забывает прежние хеши,
+ * а пока период уточняется, она откладывается.
+ */
+struct server_cycle {
+    /** @brief хеши "вселенной" после последних пакетов (кольцо)*/
+    uint64_t hash[CYCLE_HISTORY];
+    /** @brief номера поколений, после которых записаны хеши*/
+    int64_t gen[CYCLE_HISTORY];
+    /** @brief число записанных хешей*/
+    int count;
+    /** @brief число пакетов текущего моделирования*/
+    int64_t batches;
+    /** @brief хеш, повторение которого ищется при уточнении периода*/
+    uint64_t ref;
+    /** @brief поколение, после которого записан хеш ref*/
+    int64_t ref_gen;
+    /** @brief найденное кратное периода P (0, если период не уточняется)*/
+    int64_t period;
+    /** @brief цикл текущего моделирования найден, хеши больше не нужны*/
+    int done;
+};
+/** @brief состояние поиска циклов*/
+struct server_cycle cycle;
 
 /**
- * Принять сообщение от рабочего.
+ * @brief команды клиента, принятые потоком приема
  *
- * @param[in] c включает флаг IPC_NOWAIT
- * @return При успешном завершении системный вызов возвращает
- * действительную длину сообщения, скопированного в поле mtext. При
- * ошибке возвращается -1, а в переменную errno записывается код ошибки.
+ * Поток приема (server_listener()) ждет сообщений клиента в msgrcv и
+ * складывает их в кольцо, а основной поток забирает их между пакетами
+ * поколений. Пока идет моделирование, основной поток только сравнивает
+ * head и tail, не делая системных вызовов; ждет на условной переменной
+ * он, лишь когда моделирования нет.
+ */
+struct server_inbox {
+    /** @brief принятые сообщения (буферы содержимого переиспользуются)*/
+    struct life_msg msg[INBOX_SIZE];
+    /** @brief число принятых сообщений (пишет поток приема)*/
+    uint32_t head;
+    /** @brief число забранных сообщений (пишет основной поток)*/
+    uint32_t tail;
+    /** @brief мьютекс условных переменных*/
+    pthread_mutex_t lock;
+    /** @brief в кольце появилось сообщение*/
+    pthread_cond_t ready;
+    /** @brief в кольце освободилось место*/
+    pthread_cond_t space;
+};
+/** @brief команды клиента, принятые потоком приема*/
+struct server_inbox inbox = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                             .ready = PTHREAD_COND_INITIALIZER, .space = PTHREAD_COND_INITIALIZER};
+/** @brief поток приема команд клиента*/
+pthread_t listener;
+/** @brief поток приема команд клиента запущен*/
+int   listening = 0;
+
+/**
+ * Поток приема команд клиента. Сообщение принимается прямо в свободное
+ * место кольца; сообщение другой версии протокола передается с op = 0,
+ * и основной поток отвечает на него ошибкой. После O_QUIT или удаления
+ * очереди поток завершается.
  */
-ssize_t rcv_worker_message(char c) {
-    return msgrcv(msgid, (struct msgbuf*)(&message), sizeof(message), pid_server, c*IPC_NOWAIT);
+void *server_listener(void *arg) {
+    while (1) {
+        pthread_mutex_lock(&inbox.lock);
+        while (inbox.head - __atomic_load_n(&inbox.tail, __ATOMIC_ACQUIRE) == INBOX_SIZE)
+            pthread_cond_wait(&inbox.space, &inbox.lock);
+        pthread_mutex_unlock(&inbox.lock);
+
+        struct life_msg *m = &inbox.msg[inbox.head % INBOX_SIZE];
+        if (msg_recv(msgid, pid_server, m, 0) == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EPROTO) return NULL;
+        }
+
+        /* после публикации место может забрать основной поток */
+        int op = m->op;
+        pthread_mutex_lock(&inbox.lock);
+        __atomic_store_n(&inbox.head, inbox.head + 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&inbox.ready);
+        pthread_mutex_unlock(&inbox.lock);
+        if (op == O_QUIT) return NULL;
+    }
 }
 
 /**
- * Принять сообщение от клиента.
+ * Забрать очередную команду клиента, принятую потоком приема, в request.
+ * Без ожидания проверка обходится без системных вызовов.
  *
- * @param[in] c включает флаг IPC_NOWAIT
- * @return При успешном завершении системный вызов возвращает
- * действительную длину сообщения, скопированного в поле mtext. При
- * ошибке возвращается -1, а в переменную errno записывается код ошибки.
+ * @param[in] c не ждать, если команд нет
+ * @return 0, если команда забрана, -1, если команд нет
  */
-ssize_t rcv_client_message(char c) {
-    return msgrcv(msgid, (struct msgbuf*)(&message), sizeof(message), pid_server, c*IPC_NOWAIT);
+int rcv_client_message(char c) {
+    uint32_t tail = inbox.tail;
+    if (__atomic_load_n(&inbox.head, __ATOMIC_ACQUIRE) == tail) {
+        if (c) return -1;
+        pthread_mutex_lock(&inbox.lock);
+        while (__atomic_load_n(&inbox.head, __ATOMIC_ACQUIRE) == tail)
+            pthread_cond_wait(&inbox.ready, &inbox.lock);
+        pthread_mutex_unlock(&inbox.lock);
+    }
+
+    /* буфер прежней команды уходит в кольцо для следующих сообщений */
+    struct life_msg *m = &inbox.msg[tail % INBOX_SIZE], old = request;
+    request = *m;
+    *m = old;
+
+    pthread_mutex_lock(&inbox.lock);
+    __atomic_store_n(&inbox.tail, tail + 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&inbox.space);
+    pthread_mutex_unlock(&inbox.lock);
+    return 0;
 }
 
+void snd_worker_command(int i, int op, int p1, int p2);
+
 /**
- * Отправить рабочему сообщение.
+ * Отправить рабочему команду с данными. Через разделяемую память рабочий
+ * читает данные сам (например, сегмент клеток O_LOAD), поэтому они
+ * передаются только по сетевому транспорту; для O_FILL и O_ATTACH
+ * сервер сам собирает блок рабочего из буфера кадра prm1.
  *
  * @param[in] i номер рабочего
- * @param[in] c включает флаг IPC_NOWAIT
- * @return При успешном завершении возвращает 0, а при ошибке — -1, и в
- * переменную errno записывается код ошибки.
+ * @param[in] op тип команды
+ * @param[in] p1 первый параметр операции
+ * @param[in] p2 второй параметр операции
+ * @param[in] data данные команды
+ * @param[in] len длина данных
  */
-int snd_worker_message(int i, char c) {
-    message.mtype = pid_worker[i];
-    return msgsnd(msgid, (struct msgbuf*)(&message), sizeof(message), c*IPC_NOWAIT);
+void snd_worker_payload(int i, int op, int p1, int p2, const void *data, uint32_t len) {
+    if (!net_addr) {
+        snd_worker_command(i, op, p1, p2);
+        return;
+    }
+
+    char *block = NULL;
+    if (op == O_FILL || op == O_ATTACH) {
+        int x0 = row_split[i/Px], h = row_split[i/Px + 1] - x0;
+        int y0 = col_split[i%Px], w = col_split[i%Px + 1] - y0;
+        block = (char *) malloc((size_t) h * w);
+        for (int x = 0; x < h; x++) memcpy(block + (size_t) x * w, fb_row(fb, p1, x0+x) + y0, w);
+        data = block;
+        len  = h * w;
+    }
+
+    if (op != O_QUIT) net_pending[i]++;
+    net_send(net_fd[i], op, p1, p2, data, len);
+    free(block);
 }
 
 /**
- * Отправить информационное сообщение рабочему. Сообщение содержит:
- *   -# номер рабочего;
- *   -# число клеток полосы, обрабатываемой рабочим, по вертикали;
- *   -# число клеток полосы, обрабатываемой рабочим, по горизонтали.
+ * Отправить рабочему команду через его кольцо (или соединение при
+ * сетевом транспорте). Каждая команда, кроме O_QUIT, будет подтверждена
+ * рабочим.
  *
  * @param[in] i номер рабочего
- * @param[in] c включает флаг IPC_NOWAIT
+ * @param[in] op тип команды
+ * @param[in] p1 первый параметр операции
+ * @param[in] p2 второй параметр операции
+ */
+void snd_worker_command(int i, int op, int p1, int p2) {
+    if (net_addr) {
+        snd_worker_payload(i, op, p1, p2, NULL, 0);
+        return;
+    }
+    if (op != O_QUIT) acks_expected++;
+    ring_push(ctl_ring(ctl, i), op, p1, p2);
+}
+
+/**
+ * Отправить клиенту ответ на команду.
+ *
+ * @param[in] op тип операции команды
+ * @param[in] seq номер команды
+ * @param[in] p1 первый параметр ответа
+ * @param[in] p2 второй параметр ответа
+ * @param[in] text текст ответа
+ * @param[in] len длина текста
  * @return При успешном завершении возвращает 0, а при ошибке — -1, и в
  * переменную errno записывается код ошибки.
  */
-int snd_worker_info(int i, char c) {
-    message.op    = i;
-    message.prm1  = M;
-    message.prm2  = (i == K-1 && N % width) ? N % width: width;
-    return snd_worker_message(i, c);
+int snd_client_reply(int op, int seq, int p1, int p2, const char *text, uint32_t len) {
+    return msg_send(msgid, pid_client, op, p1, p2, seq, text, len);
 }
 
 /**
- * Отправить сообщение клиенту.
+ * Отправить клиенту ответ на текущую команду (текст длиннее MSG_REPLY
+ * обрезается).
  *
  * @param[in] msg текстовое содержание сообщения
  * @return При успешном завершении возвращает 0, а при ошибке — -1, и в
  * переменную errno записывается код ошибки.
  */
 int snd_client_message(char msg[]) {
-    message.mtype = pid_client;
-    sprintf(message.mtext, "%s", msg);
-    return msgsnd(msgid, (struct msgbuf*)(&message), sizeof(message), 0);
+    return snd_client_reply(request.op, request.seq, 0, 0, msg, strnlen(msg, MSG_REPLY - 1));
 }
 
 /**
- * Сервер ожидает подтверждения того, что рабочий закончил выполнение
- * команды
- * @param[in] c включает флаг IPC_NOWAIT
- * @return При успешном завершении системный вызов возвращает
- * действительную длину сообщения, скопированного в поле mtext. При
- * ошибке возвращается -1, а в переменную errno записывается код ошибки.
+ * Принять подтверждения всех отправленных рабочим команд по сетевому
+ * транспорту и разложить пришедшие с ними данные туда, где их читает
+ * сервер при разделяемой памяти: блок O_SNAP — в буфер кадра, счетчики
+ * O_STATS и хеш блока O_START — в управляющий сегмент. Если рабочий
+ * потерян, сервер завершает работу.
  */
-ssize_t server_waiting_worker(char c) {
-    return msgrcv(msgid, (struct msgbuf*)(&message), sizeof(message), worker_being_ready, c*IPC_NOWAIT);
+void server_net_acks(void) {
+    for (int i = 0; i < K; i++) {
+        for (; net_pending[i] > 0; net_pending[i]--) {
+            if (net_recv(net_fd[i], &net_reply) == -1) {
+                char msg[STRSIZE];
+                sprintf(msg, "Worker %d is lost.", i);
+                write_log(logfile, msg);
+                kill(getpid(), SIGTERM);
+                return;
+            }
+
+            if (net_reply.hdr.op == O_SNAP) {
+                int x0 = row_split[i/Px], h = row_split[i/Px + 1] - x0;
+                int y0 = col_split[i%Px], w = col_split[i%Px + 1] - y0;
+                if (net_reply.hdr.len != (uint32_t) h * w) continue;
+                for (int x = 0; x < h; x++)
+                    memcpy(fb_row(fb, net_reply.hdr.prm1, x0+x) + y0, net_reply.data + (size_t) x * w, w);
+            } else if (net_reply.hdr.op == O_STATS && net_reply.hdr.len == sizeof(struct life_stats)) {
+                memcpy(ctl_stats(ctl, i), net_reply.data, sizeof(struct life_stats));
+            } else if (net_reply.hdr.op == O_START && net_reply.hdr.len == sizeof(uint64_t)) {
+                memcpy(&ctl_stats(ctl, i)->hash, net_reply.data, sizeof(uint64_t));
+            }
+        }
+    }
 }
 
 /**
- * Инициализация сервера. Сервер
- *   -# динамически выделяет память под массивы, описанные в глобальной
- * области кода;
- *   -# подключает очередь сообщений;
- *   -# создает файлов "worker-left" и "worker-right", отвечающих за
- * семафоры и разделяемую память;
- *   -# вызывает K рабочих и отправляет им информационное сообщение.
+ * Сервер ожидает подтверждения того, что рабочие закончили выполнение
+ * всех отправленных им команд.
  */
-void server_init(void) {
-    key = ftok("server", 's');
-    msgid = msgget(key, 0666);
+void server_waiting_workers(void) {
+    if (net_addr) {
+        server_net_acks();
+        return;
+    }
+    ctl_wait_acks(ctl, acks_expected);
+}
 
-    width = (N % K) ? N/K + 1: N/K;
+/**
+ * Отправить рабочим накопленные правки клеток и дождаться, пока они их
+ * применят. Правки подряд идущих команд O_ADD, O_DEL и O_CELLS сервер не
+ * отправляет по одной: он отвечает клиенту сразу, а рабочим отправляет
+ * их пачкой (в прежнем порядке) и ждет подтверждений один раз — перед
+ * командой другого типа, перед поколением, когда новых команд нет или
+ * когда накоплено EDIT_BATCH правок.
+ */
+void server_flush_edits(void) {
+    if (!edits_pending) return;
+    for (int e = 0; e < edits_pending; e++)
+        snd_worker_command(edit[e].worker, edit[e].op, edit[e].x, edit[e].y);
+    server_waiting_workers();
+    edits_pending = 0;
+}
 
-    pid_worker = (pid_t *) calloc(K, sizeof(pid_t));
-    pid_worker_map = (int *) calloc(N, sizeof(int));
+/**
+ * Выбрать разбиение "вселенной" на Py x Px блоков. Среди разбиений, у
+ * которых каждый блок не меньше G x G, выбирается то, у которого
+ * суммарный периметр блоков (а значит, и объем ореола) наименьший. Если
+ * K рабочих разбить нельзя, их число уменьшается.
+ *
+ * @return 0 при успехе, -1, если даже один блок меньше G x G
+ */
+int server_partition(void) {
+    for (int k = K; k > 0; k--) {
+        long long best = -1;
 
-    int fd;
-    fd = open("worker-left",  O_CREAT); close(fd);
-    fd = open("worker-right", O_CREAT); close(fd);
+        for (int py = 1; py <= k; py++) {
+            if (k % py) continue;
+            int px = k / py;
+            if (M / py < G || N / px < G) continue;
 
-    semid = (int *) calloc (2*K, sizeof(int));
-    shmid = (int *) calloc (2*K, sizeof(int));
+            long long cost = (long long) py * N + (long long) px * M;
+            if (best == -1 || cost < best) {
+                best = cost;
+                Py = py;
+                Px = px;
+            }
+        }
 
-    for (int i = 0; i < K; i++) {
-        key = ftok("worker-left", i);
-        semid[2*i] = semget(key, 1, 0666 | IPC_CREAT);
-        shmid[2*i] = shmget(key, M, 0666 | IPC_CREAT);
+        if (best != -1) {
+            char msg[STRSIZE];
+            if (k != K) {
+                sprintf(msg, "The number of processes was set as %d.", k);
+                write_log(logfile, msg);
+            }
+            K = k;
+            sprintf(msg, "Universe is split into %dx%d blocks.", Py, Px);
+            write_log(logfile, msg);
+            return 0;
+        }
+    }
+    return -1;
+}
 
-        key = ftok("worker-right", i);
-        semid[2*i+1] = semget(key, 1, 0666 | IPC_CREAT);
-        shmid[2*i+1] = shmget(key, M, 0666 | IPC_CREAT);
+/**
+ * Найти рабочего, которому принадлежит клетка.
+ *
+ * @param[in] x номер строки вселенной (1..M)
+ * @param[in] y номер столбца вселенной (1..N)
+ * @param[out] lx номер строки в блоке рабочего
+ * @param[out] ly номер столбца в блоке рабочего
+ * @return номер рабочего
+ */
+int server_worker_map(int x, int y, int *lx, int *ly) {
+    int r = pid_worker_map_row[x-1];
+    int c = pid_worker_map_col[y-1];
+    *lx = x - row_split[r];
+    *ly = y - col_split[c];
+    return r*Px + c;
+}
+
+/**
+ * Построить карты распараллеливания строк и столбцов по текущим границам
+ * блоков.
+ */
+void server_build_maps(void) {
+    for (int r = 0; r < Py; r++) {
+        for (int x = row_split[r]; x < row_split[r+1]; x++)
+            pid_worker_map_row[x] = r;
+    }
+    for (int c = 0; c < Px; c++) {
+        for (int y = col_split[c]; y < col_split[c+1]; y++)
+            pid_worker_map_col[y] = c;
+    }
+}
+
+/**
+ * Создать границы всех рабочих по текущим размерам блоков: сегменты
+ * разделяемой памяти для рабочих-процессов или обычную память для
+ * рабочих-потоков. Семафоры не пересоздаются.
+ */
+void server_create_bands(void) {
+    if (engine == ENGINE_SPARSE || net_addr) return;
+
+    for (int i = 0; i < K; i++) {
+        int h = row_split[i/Px + 1] - row_split[i/Px];
+        int w = col_split[i%Px + 1] - col_split[i%Px];
 
-        for (int j = i*width; j < (i+1)*width && j < N; j++) {
-            pid_worker_map[j] = i;
+        for (int b = 0; b < 4; b++) {
+            int size = G * ((b < 2) ? h: w);
+            if (threaded) {
+                band[4*i+b] = (char *) malloc(size);
+            } else {
+                key = ftok(border_file[b], i);
+                shmid[4*i+b] = shmget(key, size, 0666 | IPC_CREAT);
+            }
         }
+    }
+}
+
+/**
+ * Удалить границы всех рабочих (операция, обратная server_create_bands()).
+ */
+void server_remove_bands(void) {
+    if (engine == ENGINE_SPARSE || net_addr) return;
+
+    for (int i = 0; i < 4*K; i++) {
+        if (threaded) {
+            free(band[i]);
+        } else shmctl(shmid[i], IPC_RMID, NULL);
+    }
+}
+
+/**
+ * Запустить рабочих-потоков. Границы и их семафоры выделяются в памяти
+ * сервера и передаются потокам напрямую.
+ */
+void server_spawn_threads(void) {
+    band     = (char **) calloc(4*K, sizeof(char *));
+    band_sem = (struct fsem *) calloc(4*K, sizeof(struct fsem));
+    thread   = (pthread_t *) calloc(K, sizeof(pthread_t));
+    thread_arg = (struct worker_arg *) calloc(K, sizeof(struct worker_arg));
+    server_create_bands();
+
+    for (int i = 0; i < K; i++) {
+        thread_arg[i].id          = i;
+        thread_arg[i].workers     = K;
+        thread_arg[i].cols_blocks = Px;
+        thread_arg[i].depth       = G;
+        thread_arg[i].kernel      = kernel_by_name(kernel_name);
+        thread_arg[i].ctl         = ctl;
+        thread_arg[i].fb          = fb;
+        thread_arg[i].chunks      = chunks;
+        thread_arg[i].band        = band;
+        thread_arg[i].sem         = band_sem;
+        pthread_create(&thread[i], NULL, worker_thread, &thread_arg[i]);
+    }
+}
+
+/**
+ * Запустить рабочих-процессов. Сервер создает файлы "worker-left",
+ * "worker-right", "worker-top" и "worker-bottom", по ним — семафоры и
+ * разделяемую память границ всех рабочих, и только затем вызывает K
+ * процессов "life-worker".
+ */
+void server_spawn_processes(void) {
+    for (int b = 0; b < 4; b++) {
+        int fd = open(border_file[b], O_CREAT, 0666);
+        close(fd);
+    }
+
+    semid = (int *) calloc (4*K, sizeof(int));
+    shmid = (int *) calloc (4*K, sizeof(int));
 
+    for (int i = 0; i < 4*K; i++) {
+        key = ftok(border_file[i%4], i/4);
+        semid[i] = semget(key, 1, 0666 | IPC_CREAT);
+    }
+    server_create_bands();
+
+    for (int i = 0; i < K; i++) {
         if (!(pid_worker[i] = fork())) {
-            char arg3[STRSIZE];
+            char arg3[STRSIZE], arg5[STRSIZE], arg7[STRSIZE], arg9[STRSIZE];
             sprintf(arg3, "%d", K);
-            execlp("./life-worker", "./life-worker", arg3, NULL);
+            sprintf(arg5, "%d", G);
+            sprintf(arg7, "%d", Px);
+            sprintf(arg9, "%d", i);
+            execlp("./life-worker", "./life-worker", arg3, "-k", kernel_name,
+                   "-g", arg5, "-p", arg7, "-i", arg9,
+                   "-e", (engine == ENGINE_SPARSE) ? "sparse": "grid", NULL);
             kill(pid_server, SIGTERM);
             quit_message("ERROR: Can't run life-worker.");
             exit(1);
         }
     }
+}
+
+/**
+ * Запустить рабочих-процессов с сетевым транспортом (см. "life-net.h").
+ * Сервер ждет рабочих на порту из ключа "-n" (0 — любой свободный) и
+ * запускает их: локально или, если задан файл "-H", командой оболочки
+ * "<строка файла> ./life-worker ...", где строка i-го рабочего — строка
+ * i по модулю числа строк (например, "ssh node1 cd plife &&"). Когда все
+ * рабочие подключились, каждому отправляются размеры "вселенной",
+ * границы блоков и адреса остальных рабочих.
+ *
+ * @return 0 при успехе, -1, если не все рабочие подключились
+ */
+int server_spawn_net(void) {
+    char host[NET_HOST_SIZE], addr[NET_HOST_SIZE + 16];
+    char *line[K];
+    int port, lines = 0;
+
+    net_parse_addr(net_addr, host, &port);
+    int lfd = net_listen(&port);
+    if (lfd == -1) return -1;
+    sprintf(addr, "%s:%d", host, port);
+
+    FILE *f = (net_hosts) ? fopen(net_hosts, "r"): NULL;
+    char buf[STRSIZE];
+    while (f && lines < K && fgets(buf, STRSIZE, f)) {
+        buf[strcspn(buf, "\n")] = '\0';
+        if (buf[0] && buf[0] != '#') line[lines++] = strdup(buf);
+    }
+    if (f) fclose(f);
 
-    counter = 0;
     for (int i = 0; i < K; i++) {
-        while (snd_worker_info(i, 1) == -1) {
-            while (server_waiting_worker(1) != -1) counter++;
+        if (!(pid_worker[i] = fork())) {
+            char arg3[16], arg5[16], arg7[16], arg9[16], cmd[2*STRSIZE];
+            sprintf(arg3, "%d", K);
+            sprintf(arg5, "%d", G);
+            sprintf(arg7, "%d", Px);
+            sprintf(arg9, "%d", i);
+            close(lfd);
+            if (lines) {
+                snprintf(cmd, sizeof(cmd), "%s ./life-worker %s -k %s -g %s -p %s -i %s -e grid -n %s",
+                         line[i % lines], arg3, kernel_name, arg5, arg7, arg9, addr);
+                execl("/bin/sh", "sh", "-c", cmd, NULL);
+            } else execlp("./life-worker", "./life-worker", arg3, "-k", kernel_name,
+                          "-g", arg5, "-p", arg7, "-i", arg9, "-e", "grid", "-n", addr, NULL);
+            exit(1);
         }
     }
-    while (counter++ < K) server_waiting_worker(0);
+    for (int k = 0; k < lines; k++) free(line[k]);
+
+    struct net_addr peer[K];
+    int connected = 0;
+    memset(peer, 0, sizeof(peer));
+    while (connected < K) {
+        char from[NET_HOST_SIZE];
+        int fd = net_accept(lfd, NET_ACCEPT_TIMEOUT, from);
+        if (fd == -1) break;
+
+        int id = -1;
+        if (net_recv(fd, &net_reply) == 0 && net_reply.hdr.op == NET_HELLO)
+            id = net_reply.hdr.prm1;
+        if (id < 0 || id >= K || net_fd[id] != -1) {
+            close(fd);
+            continue;
+        }
+        net_fd[id] = fd;
+        memcpy(peer[id].host, from, NET_HOST_SIZE);
+        peer[id].port = net_reply.hdr.prm2;
+        connected++;
+    }
+    close(lfd);
+    if (connected < K) return -1;
+
+    size_t size = (Py+1 + Px+1) * sizeof(int) + sizeof(peer);
+    char *info = (char *) malloc(size);
+    memcpy(info, row_split, (Py+1) * sizeof(int));
+    memcpy(info + (Py+1) * sizeof(int), col_split, (Px+1) * sizeof(int));
+    memcpy(info + (Py+1 + Px+1) * sizeof(int), peer, sizeof(peer));
+    for (int i = 0; i < K; i++) net_send(net_fd[i], NET_INFO, M, N, info, size);
+    free(info);
+
+    for (int i = 0; i < K; i++) net_pending[i] = 1;
+    return 0;
+}
+
+/**
+ * Инициализация сервера. Сервер
+ *   -# динамически выделяет память под массивы, описанные в глобальной
+ * области кода;
+ *   -# создает управляющий сегмент с размерами "вселенной", кольцами
+ * команд рабочих и границами блоков;
+ *   -# создает сегмент кадра для скриншотов и, для разреженной
+ * "вселенной", сегмент чанков;
+ *   -# запускает K рабочих-процессов или рабочих-потоков (ключ "-m"),
+ * при сетевом транспорте (ключ "-n") — рабочих-процессов, подключающихся
+ * по TCP, и дожидается их готовности.
+ */
+void server_init(void) {
+    pid_worker = (pid_t *) calloc(K, sizeof(pid_t));
+    pid_worker_map_row = (int *) calloc(M, sizeof(int));
+    pid_worker_map_col = (int *) calloc(N, sizeof(int));
+    busy_seen = (uint64_t *) calloc(K, sizeof(uint64_t));
+
+    key = ftok("server", 'c');
+    ctlid = shmget(key, ctl_size(K), 0666 | IPC_CREAT);
+    ctl = shmat(ctlid, NULL, 0);
+    memset(ctl, 0, ctl_size(K));
+    ctl->rows    = M;
+    ctl->cols    = N;
+    ctl->workers = K;
+    stats = ctl_stats(ctl, K);
+
+    row_split = ctl_row_split(ctl);
+    col_split = ctl_col_split(ctl);
+    for (int r = 0; r <= Py; r++) row_split[r] = life_split(M, Py, r);
+    for (int c = 0; c <= Px; c++) col_split[c] = life_split(N, Px, c);
+    server_build_maps();
+
+    key = ftok("server", 'f');
+    fbid = shmget(key, fb_size(M, N, K), 0666 | IPC_CREAT);
+    fb = shmat(fbid, NULL, 0);
+    memset(fb, 0, sizeof(struct life_fb));
+    fb->rows = M;
+    fb->cols = N;
+    fb->workers = K;
+    memset(fb_buffer(fb, 0), '.', 2 * (size_t) M * N);
+
+    if (engine == ENGINE_SPARSE) {
+        key = ftok("server", 'h');
+        chunksid = shmget(key, chunks_size(K), 0666 | IPC_CREAT);
+        chunks = shmat(chunksid, NULL, 0);
+        chunks->workers = K;
+    }
+
+    if (net_addr) {
+        net_fd = (int *) malloc(K * sizeof(int));
+        net_pending = (int *) calloc(K, sizeof(int));
+        for (int i = 0; i < K; i++) net_fd[i] = -1;
+        if (server_spawn_net() == -1) {
+            write_log(logfile, "Workers did not connect to the server.");
+            snd_client_message("ERROR: Workers did not connect to the server.");
+            for (int i = 0; i < K; i++) {
+                if (pid_worker[i] > 0) kill(pid_worker[i], SIGTERM);
+            }
+            shmctl(ctlid, IPC_RMID, NULL);
+            shmctl(fbid, IPC_RMID, NULL);
+            exit(1);
+        }
+    } else if (threaded) {
+        server_spawn_threads();
+    } else server_spawn_processes();
+
+    acks_expected = K;
+    server_waiting_workers();
 }
 
+/** @brief ответ на правку клетки за пределами "вселенной"*/
+#define CELL_OUTSIDE "ERROR: The cell is out of universe's borders."
+
 /**
  * Cервер отправляет рабочему с командой добавить/удалить клетку во/из
- * вселенную/ой.
+ * вселенную/ой. Разреженная "вселенная" не ограничена, и рабочему
+ * передаются координаты клетки во "вселенной".
  * @param[in] x номер строки вселенной
  * @param[in] y номер строки вселенной
  * @param[in] c выбор операции: 1 - добавить клетку, 0 - удалить клетку
+ * @return 0 при успехе, -1, если клетка лежит за пределами "вселенной"
  */
-void server_add(int x, int y, char c) {
+int server_put_cell(int x, int y, char c) {
     char msg[STRSIZE];
 
-    if (!(1 <= x && x <= M && 1 <= y && y <= N)) {
-        snd_client_message("ERROR: The cell is out of universe's borders.");
+    if (engine != ENGINE_SPARSE && !(1 <= x && x <= M && 1 <= y && y <= N)) {
         sprintf(msg, "The cell (%d,%d) is out of universe's borders.", x, y);
         write_log(logfile, msg);
-        return;
+        return -1;
     }
 
-    int i = pid_worker_map[y-1];
-    message.op   = (c) ? O_ADD: O_DEL;
-    message.prm1 = x;
-    message.prm2 = (y-1) % width + 1;
-    snd_worker_message(i, 0);
-    server_waiting_worker(0);
-    snd_client_message("OK");
+    int lx = x, ly = y, i;
+    if (engine == ENGINE_SPARSE) {
+        i = chunk_owner(chunk_index(x-1), chunk_index(y-1), K);
+    } else i = server_worker_map(x, y, &lx, &ly);
+    edit[edits_pending++] = (struct server_edit) {i, (c) ? O_ADD: O_DEL, lx, ly};
+    if (edits_pending == EDIT_BATCH) server_flush_edits();
 
     if (c) {
         sprintf(msg, "The cell (%d,%d) is added.", x, y);
     } else sprintf(msg, "The cell (%d,%d) is deleted.", x, y);
     write_log(logfile, msg);
+    return 0;
+}
+
+/**
+ * Добавить или удалить одну клетку (команды O_ADD и O_DEL).
+ * @param[in] x номер строки вселенной
+ * @param[in] y номер строки вселенной
+ * @param[in] c выбор операции: 1 - добавить клетку, 0 - удалить клетку
+ */
+void server_add(int x, int y, char c) {
+    snd_client_message((server_put_cell(x, y, c) == 0) ? "OK": CELL_OUTSIDE);
+}
+
+/**
+ * Добавить и удалить пачку клеток (команда O_CELLS). В ответе по строке
+ * на каждую клетку — те же ответы, что и на O_ADD и O_DEL.
+ */
+void server_cells(void) {
+    const struct msg_cell *cell = (const struct msg_cell *) request.data;
+    int n = request.len / sizeof(struct msg_cell);
+
+    if (n == 0 || n > MSG_CELLS) {
+        snd_client_message("ERROR: Wrong cell batch.");
+        write_log(logfile, "Wrong cell batch.");
+        return;
+    }
+
+    char *text = (char *) malloc((size_t) n * MSG_LINE);
+    uint32_t len = 0;
+    for (int k = 0; k < n; k++) {
+        const char *r = (server_put_cell(cell[k].x, cell[k].y, cell[k].alive) == 0) ? "OK": CELL_OUTSIDE;
+        len += sprintf(text + len, "%s\n", r);
+    }
+    snd_client_reply(request.op, request.seq, 0, 0, text, len - 1);
+    free(text);
 }
 
 /**
@@ -221,21 +849,382 @@ void server_clear(void) {
         return;
     }
 
-    counter = 0;
-    for (int i = 0; i < K; i++) {
-        message.op = O_CLEAR;
-        while (snd_worker_message(i, 1) == -1) {
-            while (server_waiting_worker(1) != -1) counter++;
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_CLEAR, 0, 0);
+    server_waiting_workers();
+
+    snd_client_message("OK");
+    write_log(logfile, "Universe is cleaned.");
+}
+
+/**
+ * Сервер меняет правило "вселенной". Запись правила B/S клиент передает
+ * в содержимом сообщения, рабочим отправляются маски рождения и
+ * выживания, по которым они строят таблицы правила. Разреженная
+ * "вселенная" не принимает правил с рождением при 0 соседей: по ним
+ * оживает вся бесконечная плоскость, которую чанки представить не могут.
+ */
+void server_rule(void) {
+    char msg[STRSIZE], text[KERNEL_RULE_SIZE];
+    uint16_t birth, survive;
+
+    if (steps > 0) {
+        snd_client_message("ERROR: The server is working now.");
+        write_log(logfile, "The server is working now...");
+        return;
+    }
+
+    if (kernel_rule_parse(request.data, &birth, &survive) == -1) {
+        snd_client_message("ERROR: Wrong rule.");
+        snprintf(msg, STRSIZE, "Wrong rule %.1000s.", request.data);
+        write_log(logfile, msg);
+        return;
+    }
+
+    if (engine == ENGINE_SPARSE && (birth & 1)) {
+        snd_client_message("ERROR: Rules with B0 are not supported by the sparse engine.");
+        write_log(logfile, "Rules with B0 are not supported by the sparse engine.");
+        return;
+    }
+
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_RULE, birth, survive);
+    server_waiting_workers();
+    rule_birth = birth;
+    rule_survive = survive;
+
+    kernel_rule_format(birth, survive, text);
+    snd_client_message("OK");
+    snprintf(msg, STRSIZE, "Rule %s is set.", text);
+    write_log(logfile, msg);
+}
+
+/**
+ * Сервер загружает образец из файла и раскладывает его клетки по
+ * рабочим. Клетки группируются по картам распараллеливания и
+ * складываются в один сегмент разделяемой памяти, после чего каждому
+ * рабочему, которому достались клетки, отправляется одна команда O_LOAD.
+ * Образец, выходящий за границы "вселенной", замыкается на тор; в
+ * разреженную "вселенную" клетки передаются в координатах "вселенной" и
+ * раскладываются по владельцам чанков.
+ * @param[in] x номер строки левого верхнего угла образца
+ * @param[in] y номер столбца левого верхнего угла образца
+ */
+void server_load(int x, int y) {
+    char msg[STRSIZE], path[STRSIZE];
+    snprintf(path, STRSIZE, "%s", request.data);
+
+    if (engine != ENGINE_SPARSE && !(1 <= x && x <= M && 1 <= y && y <= N)) {
+        snd_client_message("ERROR: The cell is out of universe's borders.");
+        sprintf(msg, "The cell (%d,%d) is out of universe's borders.", x, y);
+        write_log(logfile, msg);
+        return;
+    }
+
+    long count;
+    struct pattern_cell *cell = pattern_read(path, &count);
+    if (!cell) {
+        snd_client_message("ERROR: Can't read the pattern.");
+        snprintf(msg, STRSIZE, "Can't read the pattern %.1000s.", path);
+        write_log(logfile, msg);
+        return;
+    }
+
+    for (long k = 0; engine == ENGINE_SPARSE && k < count; k++) {
+        if (x + (long) cell[k].x > INT_MAX || y + (long) cell[k].y > INT_MAX) {
+            free(cell);
+            snd_client_message("ERROR: The pattern is out of universe's borders.");
+            write_log(logfile, "The pattern is out of universe's borders.");
+            return;
+        }
+    }
+
+    int *owner = (int *) calloc(count + 1, sizeof(int));
+    int *total = (int *) calloc(K, sizeof(int));
+    for (long k = 0; k < count; k++) {
+        if (engine == ENGINE_SPARSE) {
+            cell[k].x += x;
+            cell[k].y += y;
+            owner[k] = chunk_owner(chunk_index(cell[k].x-1), chunk_index(cell[k].y-1), K);
+            total[owner[k]]++;
+            continue;
         }
+        cell[k].x = ((x-1 + (long) cell[k].x) % M + M) % M + 1;
+        cell[k].y = ((y-1 + (long) cell[k].y) % N + N) % N + 1;
+        owner[k] = server_worker_map(cell[k].x, cell[k].y, &cell[k].x, &cell[k].y);
+        total[owner[k]]++;
+    }
+
+    int id = shmget(IPC_PRIVATE, (2*K + 2*count) * sizeof(int), 0600 | IPC_CREAT);
+    int *payload = shmat(id, NULL, 0);
+    for (int i = 0, offset = 0; i < K; i++) {
+        payload[i]   = offset;
+        payload[K+i] = 0;
+        offset += total[i];
+    }
+    for (long k = 0; k < count; k++) {
+        int *p = payload + 2*K + 2*(payload[owner[k]] + payload[K+owner[k]]++);
+        p[0] = cell[k].x;
+        p[1] = cell[k].y;
+    }
+
+    for (int i = 0; i < K; i++) {
+        if (total[i]) snd_worker_payload(i, O_LOAD, id, 0, payload + 2*K + 2*payload[i],
+                                         2 * total[i] * sizeof(int));
     }
-    while (counter++ < K) server_waiting_worker(0);
+    server_waiting_workers();
+
+    shmdt(payload);
+    shmctl(id, IPC_RMID, NULL);
+    free(owner);
+    free(total);
+    free(cell);
 
     snd_client_message("OK");
-    write_log(logfile, "Universe is cleaned.");
+    snprintf(msg, STRSIZE, "The pattern %.1000s (%ld cells) is loaded.", path, count);
+    write_log(logfile, msg);
+}
+
+/**
+ * Записать "вселенную" в контрольную точку ctl->path через задний буфер
+ * кадра: при сетевом транспорте у рабочих может не быть доступа к файлу,
+ * поэтому блоки собираются в кадр, а упаковывает их сервер.
+ */
+void server_save_frame(void) {
+    int b = 1 - fb->front;
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_SNAP, b, 0);
+    server_waiting_workers();
+
+    int fd = open(ctl->path, O_RDWR);
+    void *base = (fd == -1) ? MAP_FAILED: mmap(NULL, ckpt_size(M, N), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd != -1) close(fd);
+    if (base == MAP_FAILED) return;
+
+    for (int x = 0; x < M; x++) kernel_pack_row(fb_row(fb, b, x), ckpt_row(base, x), N);
+    munmap(base, ckpt_size(M, N));
+}
+
+/**
+ * Восстановить "вселенную" из контрольной точки ctl->path через задний
+ * буфер кадра (операция, обратная server_save_frame()): сервер
+ * распаковывает файл в кадр, и рабочие заполняют из него блоки.
+ */
+void server_restore_frame(void) {
+    int b = 1 - fb->front;
+    int fd = open(ctl->path, O_RDONLY);
+    void *base = (fd == -1) ? MAP_FAILED: mmap(NULL, ckpt_size(M, N), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (fd != -1) close(fd);
+    if (base == MAP_FAILED) return;
+
+    for (int x = 0; x < M; x++) kernel_unpack_row(ckpt_row(base, x), fb_row(fb, b, x), 0, N);
+    munmap(base, ckpt_size(M, N));
+
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_FILL, b, 0);
 }
 
 /**
- * Cервер устанавливает счетчик поколений "steps"
+ * Сервер сохраняет "вселенную" в контрольную точку. Сервер создает файл
+ * нужного размера, заполненный нулями, и записывает заголовок, после
+ * чего рабочие параллельно записывают в файл свои блоки.
+ */
+void server_save(void) {
+    char msg[STRSIZE];
+    if (engine == ENGINE_SPARSE) {
+        snd_client_message("ERROR: Checkpoints of the sparse universe are not supported.");
+        write_log(logfile, "Checkpoints of the sparse universe are not supported.");
+        return;
+    }
+
+    snprintf(ctl->path, CTL_PATH_SIZE, "%s", request.data);
+
+    int fd = open(ctl->path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1 || ftruncate(fd, ckpt_size(M, N)) == -1) {
+        if (fd != -1) close(fd);
+        snd_client_message("ERROR: Can't create the checkpoint.");
+        snprintf(msg, STRSIZE, "Can't create the checkpoint %.1000s.", ctl->path);
+        write_log(logfile, msg);
+        return;
+    }
+
+    struct ckpt_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CKPT_MAGIC, sizeof(header.magic));
+    header.version    = CKPT_VERSION;
+    header.rows       = M;
+    header.cols       = N;
+    header.words      = ckpt_words(N);
+    header.generation = generation;
+    kernel_rule_format(rule_birth, rule_survive, header.rule);
+    pwrite(fd, &header, sizeof(header), 0);
+    close(fd);
+
+    if (net_addr) {
+        server_save_frame();
+    } else {
+        for (int i = 0; i < K; i++) snd_worker_command(i, O_SAVE, 0, 0);
+        server_waiting_workers();
+    }
+
+    snd_client_message("OK");
+    snprintf(msg, STRSIZE, "Checkpoint %.1000s is saved (generation %lld).",
+             ctl->path, (long long) generation);
+    write_log(logfile, msg);
+}
+
+/**
+ * Сервер восстанавливает "вселенную" из контрольной точки. Размеры
+ * "вселенной" в файле должны совпадать с текущими, число рабочих может
+ * отличаться.
+ */
+void server_restore(void) {
+    char msg[STRSIZE];
+    if (engine == ENGINE_SPARSE) {
+        snd_client_message("ERROR: Checkpoints of the sparse universe are not supported.");
+        write_log(logfile, "Checkpoints of the sparse universe are not supported.");
+        return;
+    }
+
+    snprintf(ctl->path, CTL_PATH_SIZE, "%s", request.data);
+
+    struct ckpt_header header;
+    struct stat st;
+    uint16_t birth, survive;
+    int fd = open(ctl->path, O_RDONLY);
+    int ok = fd != -1 && fstat(fd, &st) != -1 &&
+             pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+             memcmp(header.magic, CKPT_MAGIC, sizeof(header.magic)) == 0 &&
+             header.version == CKPT_VERSION &&
+             header.rows == M && header.cols == N &&
+             header.words == ckpt_words(N) &&
+             (size_t) st.st_size >= ckpt_size(M, N) &&
+             memchr(header.rule, '\0', sizeof(header.rule)) &&
+             kernel_rule_parse(header.rule, &birth, &survive) == 0;
+    if (fd != -1) close(fd);
+
+    if (!ok) {
+        snd_client_message("ERROR: Wrong checkpoint file.");
+        snprintf(msg, STRSIZE, "Wrong checkpoint file %.1000s.", ctl->path);
+        write_log(logfile, msg);
+        return;
+    }
+
+    if (net_addr) {
+        server_restore_frame();
+    } else for (int i = 0; i < K; i++) snd_worker_command(i, O_RESTORE, 0, 0);
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_RULE, birth, survive);
+    server_waiting_workers();
+    generation = header.generation;
+    rule_birth = birth;
+    rule_survive = survive;
+
+    snd_client_message("OK");
+    snprintf(msg, STRSIZE, "Checkpoint %.1000s is restored (generation %lld).",
+             ctl->path, (long long) generation);
+    write_log(logfile, msg);
+}
+
+/**
+ * Пересчитать границы частей отрезка так, чтобы суммарная стоимость
+ * частей выровнялась. Стоимость считается распределенной внутри части
+ * равномерно; каждая граница сдвигается на половину пути к новому
+ * положению, а части остаются не уже G.
+ *
+ * @param[in,out] split границы частей (parts+1 чисел)
+ * @param[in] parts число частей
+ * @param[in] cost измеренная стоимость каждой части
+ * @return 1, если границы изменились, иначе 0
+ */
+int server_balance_split(int *split, int parts, const double *cost) {
+    double total = 0, worst = 0;
+    for (int p = 0; p < parts; p++) {
+        total += cost[p];
+        if (cost[p] > worst) worst = cost[p];
+    }
+    if (parts < 2 || total <= 0 || worst < 1.1 * total / parts) return 0;
+
+    int n = split[parts], next[parts+1];
+    next[0] = 0;
+    next[parts] = n;
+
+    double sum = 0;
+    for (int k = 1, p = 0; k < parts; k++) {
+        double target = total * k / parts;
+        while (p < parts-1 && sum + cost[p] < target) sum += cost[p++];
+
+        double pos = split[p+1];
+        if (cost[p] > 0) pos = split[p] + (target - sum) / cost[p] * (split[p+1] - split[p]);
+        next[k] = split[k] + (int) ((pos - split[k]) / 2);
+    }
+
+    for (int k = 1; k < parts; k++) {
+        if (next[k] < next[k-1] + G) next[k] = next[k-1] + G;
+    }
+    for (int k = parts-1; k > 0; k--) {
+        if (next[k] > next[k+1] - G) next[k] = next[k+1] - G;
+    }
+
+    int changed = 0;
+    for (int k = 1; k < parts; k++) {
+        if (next[k] != split[k]) changed = 1;
+        split[k] = next[k];
+    }
+    return changed;
+}
+
+/**
+ * Перебалансировать нагрузку рабочих. По приросту счетчиков busy
+ * вычисляется стоимость рядов и колонок блоков, и их границы сдвигаются
+ * в сторону более дорогих блоков. Если границы изменились:
+ *   -# рабочие копируют блоки в задний буфер кадра (O_SNAP);
+ *   -# рабочие освобождают карты и границы (O_DETACH);
+ *   -# сервер пересоздает границы под новые размеры блоков и обновляет
+ * карты распараллеливания;
+ *   -# рабочие занимают новые блоки и заполняют их из кадра (O_ATTACH).
+ */
+void server_rebalance(void) {
+    double row_cost[Py], col_cost[Px];
+    memset(row_cost, 0, sizeof(row_cost));
+    memset(col_cost, 0, sizeof(col_cost));
+
+    for (int i = 0; i < K; i++) {
+        uint64_t busy = __atomic_load_n(&ctl_ring(ctl, i)->busy, __ATOMIC_RELAXED);
+        row_cost[i/Px] += busy - busy_seen[i];
+        col_cost[i%Px] += busy - busy_seen[i];
+        busy_seen[i] = busy;
+    }
+
+    int changed = server_balance_split(row_split, Py, row_cost);
+    changed |= server_balance_split(col_split, Px, col_cost);
+    if (!changed) return;
+
+    int b = 1 - fb->front;
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_SNAP, b, 0);
+    server_waiting_workers();
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_DETACH, 0, 0);
+    server_waiting_workers();
+
+    server_remove_bands();
+    server_create_bands();
+    server_build_maps();
+
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_ATTACH, b, 0);
+    server_waiting_workers();
+
+    /* хеши блоков зависят от их границ */
+    cycle.count = 0;
+
+    for (int i = 0; i < K; i++)
+        busy_seen[i] = __atomic_load_n(&ctl_ring(ctl, i)->busy, __ATOMIC_RELAXED);
+
+    char msg[STRSIZE];
+    int len = sprintf(msg, "Blocks are rebalanced: rows");
+    for (int r = 1; r < Py && len < STRSIZE - 32; r++) len += sprintf(msg+len, " %d", row_split[r]);
+    len += sprintf(msg+len, ", columns");
+    for (int c = 1; c < Px && len < STRSIZE - 32; c++) len += sprintf(msg+len, " %d", col_split[c]);
+    write_log(logfile, msg);
+}
+
+/**
+ * Cервер устанавливает счетчик поколений "steps" (если клиент не указал
+ * число поколений, моделирование идет до команды O_STOP)
  */
 void server_start(void) {
     if (steps > 0) {
@@ -244,30 +1233,248 @@ void server_start(void) {
         return;
     }
 
-    if (message.prm1 < 1) {
+    if (request.prm1 < 0) {
         snd_client_message("ERROR: The number of generation should be postive one.");
         write_log(logfile, "The number of generation should be postive one.");
         return;
     }
 
-    steps = message.prm1;
+    steps = (request.prm1) ? request.prm1: STEPS_ENDLESS;
     snd_client_message("OK");
-    write_log(logfile, "Simulation is started.");
+    if (steps == STEPS_ENDLESS) {
+        write_log(logfile, "Simulation is started until stopped.");
+    } else write_log(logfile, "Simulation is started.");
+}
+
+/**
+ * Нужны ли хеши блоков после очередного пакета. Циклы ищутся только при
+ * заданном числе поколений, без потока кадров (он должен получить
+ * каждый кадр) и не для HashLife, который сам запоминает повторяющиеся
+ * части "вселенной". Хеш стоит одного прохода по блоку, поэтому при
+ * коротких пакетах он считается не после каждого из них; при уточнении
+ * периода — после каждого.
+ *
+ * @return 1, если после пакета нужны хеши блоков, иначе 0
+ */
+int server_cycle_active(void) {
+    if (!cycle_every || steps == STEPS_ENDLESS || stream.file || engine == ENGINE_HASHLIFE || cycle.done)
+        return 0;
+    int stride = (cycle_every > G) ? cycle_every / G: 1;
+    return cycle.period || cycle.batches % stride == 0;
+}
+
+/**
+ * Забыть хеши и найденный период: "вселенную" изменил клиент или
+ * начинается новое моделирование.
+ */
+void server_cycle_reset(void) {
+    cycle.count   = 0;
+    cycle.batches = 0;
+    cycle.period  = 0;
+    cycle.done    = 0;
+    stats->period = 0;
+}
+
+/**
+ * Пропустить поколения, которые повторяют уже построенные: "вселенная"
+ * после них такая же, как сейчас.
+ *
+ * @param[in] skip число поколений, кратное периоду цикла
+ */
+void server_cycle_skip(int64_t skip) {
+    generation    += skip;
+    steps         -= skip;
+    stats->skipped += skip;
+    __atomic_store_n(&stats->generations, generation, __ATOMIC_RELAXED);
+}
+
+/**
+ * Собрать хеш "вселенной" после пакета и поискать его среди прежних
+ * (см. struct server_cycle).
+ */
+void server_cycle(void) {
+    char msg[STRSIZE];
+    int active = server_cycle_active();
+    cycle.batches++;
+    if (!active) return;
+
+    uint64_t h = 0;
+    for (int i = 0; i < K; i++) h = (h * 0x100000001b3ULL) ^ ctl_stats(ctl, i)->hash;
+    stats->hash = h;
+
+    if (cycle.period) {
+        if (h != cycle.ref) return;
+        int64_t p = generation - cycle.ref_gen;
+        stats->period = p;
+        cycle.period  = 0;
+        cycle.done    = 1;
+        server_cycle_skip(steps / p * p);
+        sprintf(msg, "Cycle of period %lld is found, generation %lld is reached.",
+                (long long) p, (long long) generation);
+        write_log(logfile, msg);
+        return;
+    }
+
+    int n = (cycle.count < CYCLE_HISTORY) ? cycle.count: CYCLE_HISTORY;
+    for (int k = 0; k < n; k++) {
+        int64_t period = generation - cycle.gen[k];
+        if (cycle.hash[k] != h || steps < period) continue;
+        server_cycle_skip((steps / period - 1) * period);
+        cycle.ref     = h;
+        cycle.ref_gen = generation;
+        cycle.period  = period;
+        return;
+    }
+
+    cycle.hash[cycle.count % CYCLE_HISTORY] = h;
+    cycle.gen[cycle.count % CYCLE_HISTORY]  = generation;
+    cycle.count++;
+}
+
+/**
+ * Наибольшее число поколений следующего пакета: "steps", но при записи
+ * потока кадров — не дальше поколения следующего кадра, чтобы кадры
+ * попадали точно на поколения, кратные периоду, а при уточнении периода
+ * цикла — одно поколение.
+ *
+ * @return число поколений
+ */
+int server_batch_limit(void) {
+    if (cycle.period) return 1;
+    if (!stream.file) return steps;
+    int left = stream.every - (int) (generation % stream.every);
+    return (left < steps) ? left: steps;
+}
+
+/**
+ * Cервер отправляет сообщения рабочим с командой построить пакет из не
+ * более чем G следующих поколений
+ *
+ * @return число поколений в пакете
+ */
+int server_next_generation(void) {
+    int limit = server_batch_limit();
+    int gens = (limit < G) ? limit: G;
+
+    int hash = server_cycle_active();
+
+    uint64_t t0 = stats_now();
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_START, gens, hash);
+    uint64_t t1 = stats_now();
+    server_waiting_workers();
+    uint64_t t2 = stats_now();
+    generation += gens;
+
+    stats_add(&stats->phase[ST_DISPATCH], t1 - t0);
+    stats_add(&stats->phase[ST_ACKS], t2 - t1);
+    stats_add(&stats->phase[ST_BATCH], t2 - t0);
+    __atomic_store_n(&stats->generations, generation, __ATOMIC_RELAXED);
+    return gens;
+}
+
+/**
+ * Сервер строит наибольшую степень двойки поколений, не превышающую
+ * server_batch_limit(), алгоритмом HashLife. Рабочие копируют блоки в задний буфер
+ * кадра, сервер строит по нему квадродерево, продвигает его и
+ * записывает результат обратно в буфер, из которого рабочие заполняют
+ * блоки. Карта рабочих остается основной, поэтому остальные команды
+ * работают без изменений.
+ *
+ * @return число построенных поколений
+ */
+int server_hash_generation(void) {
+    int limit = server_batch_limit();
+    int j = 0;
+    while (j < 30 && (2 << j) <= limit) j++;
+
+    uint64_t t0 = stats_now();
+    int b = 1 - fb->front;
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_SNAP, b, 0);
+    server_waiting_workers();
+
+    hash_rule(&hash, rule_birth, rule_survive);
+    uint32_t root = hash_import(&hash, fb_buffer(fb, b));
+    root = hash_advance(&hash, root, j);
+    hash_export(&hash, root, fb_buffer(fb, b));
+
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_FILL, b, 0);
+    server_waiting_workers();
+    generation += 1 << j;
+
+    stats_add(&stats->phase[ST_BATCH], stats_now() - t0);
+    __atomic_store_n(&stats->generations, generation, __ATOMIC_RELAXED);
+    return 1 << j;
 }
 
 /**
- * Cервер отправляет сообщения рабочим с командой построить следующее
- * поколение
+ * Сервер строит пакет из не более чем G поколений разреженной
+ * "вселенной": каждое поколение — два этапа, O_GROW и O_START, после
+ * каждого из которых сервер дожидается всех рабочих. Если кому-то из
+ * рабочих не хватило места для чанков, моделирование останавливается
+ * (и при запуске до команды O_STOP тоже): "steps" обнуляется.
+ *
+ * @return число поколений, на которое уменьшается "steps"
  */
-void server_next_generation(void) {
-    counter = 0;
+int server_sparse_generation(void) {
+    int limit = server_batch_limit();
+    int gens = (limit < G) ? limit: G;
+
+    int hash = server_cycle_active();
+
+    uint64_t t0 = stats_now();
+    for (int t = 0; t < gens; t++) {
+        for (int i = 0; i < K; i++) snd_worker_command(i, O_GROW, 0, 0);
+        server_waiting_workers();
+        for (int i = 0; i < K; i++) snd_worker_command(i, O_START, 1, hash && t == gens-1);
+        server_waiting_workers();
+    }
+    generation += gens;
+
+    stats_add(&stats->phase[ST_BATCH], stats_now() - t0);
+    __atomic_store_n(&stats->generations, generation, __ATOMIC_RELAXED);
+
     for (int i = 0; i < K; i++) {
-        message.op = O_START;
-        while (snd_worker_message(i, 1) == -1) {
-            while (server_waiting_worker(1) != -1) counter++;
+        if (chunks_part(chunks, i)->overflow) {
+            write_log(logfile, "Chunk memory is exhausted, simulation is stopped.");
+            steps = 0;
+            return 0;
         }
     }
-    while (counter++ < K) server_waiting_worker(0);
+    return gens;
+}
+
+/**
+ * Клиент ждет окончания моделирования: если поколения уже построены,
+ * сервер отвечает сразу, иначе — когда счетчик "steps" обнулится.
+ */
+void server_wait(void) {
+    if (steps == STEPS_ENDLESS) {
+        snd_client_message("ERROR: The simulation runs until stopped.");
+        write_log(logfile, "The simulation runs until stopped.");
+    } else if (steps == 0) {
+        snd_client_message("OK");
+    } else {
+        client_waiting = 1;
+        client_waiting_seq = request.seq;
+    }
+}
+
+/**
+ * Сервер просит рабочих подсчитать живые клетки блоков и записывает их
+ * сумму в свои счетчики. Гистограммы этапов клиент читает из
+ * управляющего сегмента сам.
+ */
+void server_stats(void) {
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_STATS, 0, 0);
+    server_waiting_workers();
+
+    int64_t live = 0;
+    for (int i = 0; i < K; i++) live += ctl_stats(ctl, i)->live;
+    stats->live = live;
+    stats->generations = generation;
+
+    snd_client_message("OK");
+    write_log(logfile, "Statistics are collected.");
 }
 
 /**
@@ -285,61 +1492,180 @@ void server_stop(void) {
 }
 
 /**
- * Cервер отправляет сообщения рабочим с командой сделать скриншот
- * текущего состояния вселенной, а затем пересылает его клиенту
+ * Cервер отправляет рабочим команду скопировать свои блоки в задний
+ * буфер кадра, дожидается их, помечает буфер номером поколения и делает
+ * его передним. Клиенту отправляется номер буфера, который он читает из
+ * разделяемой памяти сам. Рабочие разреженной "вселенной" записывают
+ * только живые клетки, поэтому буфер предварительно очищается.
+ *
+ * Если клиенту нужны только изменения, то до смены переднего буфера
+ * рабочие сравнивают по полосе строк задний буфер с передним (O_DELTA;
+ * при сетевом транспорте кадра у рабочих нет, и сравнивает сервер),
+ * и клиенту отправляется общее число отрезков. Если отрезки не поместились
+ * хотя бы в один список, клиент получает "full" и печатает кадр целиком.
+ *
+ * @param[in] delta нужны только изменения с прошлого скриншота
  */
-void server_snap(void) {
-    snd_client_message("OK");
-    char msg[STRSIZE];
-    for (int j = 1; j <= M; j++) {
+void server_snap(int delta) {
+    int b = 1 - fb->front;
+    if (engine == ENGINE_SPARSE) memset(fb_buffer(fb, b), '.', (size_t) M * N);
+
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_SNAP, b, 0);
+    server_waiting_workers();
+
+    long long runs = 0;
+    int full = 0;
+    if (delta) {
+        if (net_addr) {
+            for (int i = 0; i < K; i++)
+                fb_delta_rows(fb, b, life_split(M, K, i), life_split(M, K, i+1), fb_delta(fb, i));
+        } else {
+            for (int i = 0; i < K; i++) snd_worker_command(i, O_DELTA, b, 0);
+            server_waiting_workers();
+        }
         for (int i = 0; i < K; i++) {
-            message.op   = O_SNAP;
-            message.prm1 = j;
-            snd_worker_message(i, 0);
-
-            rcv_worker_message(0);
-            int offset = message.prm1 * width;
-            int len = message.prm2;
-            memcpy(&msg[offset], message.mtext, len);
-            msg[N] = '\0';
+            runs += fb_delta(fb, i)->count;
+            full |= fb_delta(fb, i)->overflow;
         }
-        message.prm1 = j;
-        snd_client_message(msg);
     }
-    write_log(logfile, "Snapshot is made.");
+
+    fb->generation[b] = generation;
+    __atomic_store_n(&fb->front, b, __ATOMIC_RELEASE);
+
+    char msg[STRSIZE];
+    if (!delta) {
+        snd_client_reply(request.op, request.seq, b, (int) generation, "OK", 2);
+        write_log(logfile, "Snapshot is made.");
+    } else if (full) {
+        snd_client_reply(request.op, request.seq, b, (int) generation, "OK full", 7);
+        write_log(logfile, "Delta snapshot overflowed, the full frame is sent.");
+    } else {
+        sprintf(msg, "OK %lld", runs);
+        snd_client_reply(request.op, request.seq, b, (int) generation, msg, strlen(msg));
+        sprintf(msg, "Delta snapshot is made: %lld runs.", runs);
+        write_log(logfile, msg);
+    }
+}
+
+/**
+ * Поставить текущее поколение в очередь потока кадров. Рабочие копируют
+ * блоки в задний буфер кадра, как при перебалансировке, поэтому передний
+ * буфер (последний скриншот клиента) не меняется.
+ */
+void server_stream_frame(void) {
+    char rule[KERNEL_RULE_SIZE];
+    int b = 1 - fb->front;
+    if (engine == ENGINE_SPARSE) memset(fb_buffer(fb, b), '.', (size_t) M * N);
+
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_SNAP, b, 0);
+    server_waiting_workers();
+
+    kernel_rule_format(rule_birth, rule_survive, rule);
+    stream_push(&stream, fb_buffer(fb, b), generation, rule);
+}
+
+/**
+ * Закрыть поток кадров и записать в лог число записанных и пропущенных
+ * кадров.
+ */
+void server_stream_close(void) {
+    char msg[STRSIZE];
+
+    if (!stream.file) return;
+    stream_close(&stream);
+    sprintf(msg, "Stream is closed: %ld frames written, %ld dropped%s.", stream.written,
+            stream.dropped, (stream.failed) ? ", write error": "");
+    write_log(logfile, msg);
+}
+
+/**
+ * Начать или прекратить запись потока кадров. Новый поток заменяет
+ * прежний; первым записывается текущее поколение, затем кадр
+ * записывается после каждых request.prm1 поколений.
+ */
+void server_stream(void) {
+    char msg[STRSIZE];
+
+    if (request.prm1 < 0) {
+        snd_client_message("ERROR: The frame period should be non-negative.");
+        write_log(logfile, "The frame period should be non-negative.");
+        return;
+    }
+
+    server_stream_close();
+    if (request.prm1 == 0) {
+        snd_client_message("OK");
+        return;
+    }
+
+    if (stream_open(&stream, request.data, M, N, request.prm1) == -1) {
+        sprintf(msg, "Cannot open the stream file %.256s.", request.data);
+        write_log(logfile, msg);
+        snd_client_message("ERROR: Cannot open the stream file.");
+        return;
+    }
+    sprintf(msg, "Stream to %.256s every %d generations is started.", request.data, request.prm1);
+    server_stream_frame();
+
+    snd_client_message("OK");
+    write_log(logfile, msg);
 }
 
 /**
  * Cервер завершает свою работу:
- *   -# посылает сообщения рабочим с командой завершить работу;
- *   -# удаляет разделяемую память и семафоры;
+ *   -# посылает рабочим команду завершить работу;
+ *   -# удаляет разделяемую память, управляющий сегмент и семафоры;
  *   -# освобождение динамической памяти;
  *   -# отключает очередь сообщений;
  *   -# отправляет уведомление клиенту.
  */
 void server_quit(void) {
-    for (int i = 0; i < K; i++) {
-        message.mtype = pid_worker[i];
-        message.op    = O_QUIT;
-        msgsnd(msgid, (struct msgbuf*)(&message), sizeof(message), 0);
-    }
+    server_stream_close();
+    for (int i = 0; i < K; i++) snd_worker_command(i, O_QUIT, 0, 0);
 
-    while (wait(NULL) > 0);
+    if (net_addr) {
+        for (int i = 0; i < K; i++) close(net_fd[i]);
+        while (wait(NULL) > 0);
+        free(net_fd);
+        free(net_pending);
+        free(net_reply.data);
+    } else if (threaded) {
+        for (int i = 0; i < K; i++) pthread_join(thread[i], NULL);
+        server_remove_bands();
+        free(band);
+        free(band_sem);
+        free(thread);
+        free(thread_arg);
+    } else while (wait(NULL) > 0);
 
-    for (int i = 0; i < K; i++) {
-        shmctl(shmid[2*i], IPC_RMID, NULL);
-        semctl(semid[2*i], 0, IPC_RMID, (int) 0);
-        shmctl(shmid[2*i+1], IPC_RMID, NULL);
-        semctl(semid[2*i+1], 0, IPC_RMID, (int) 0);
+    shmdt(ctl);
+    shmctl(ctlid, IPC_RMID, NULL);
+    shmdt(fb);
+    shmctl(fbid, IPC_RMID, NULL);
+    if (chunks) {
+        shmdt(chunks);
+        shmctl(chunksid, IPC_RMID, NULL);
     }
-    free(shmid);
-    free(semid);
 
-    free(pid_worker);
-    free(pid_worker_map);
+    if (!threaded && !net_addr) {
+        server_remove_bands();
+        for (int i = 0; i < 4*K; i++) semctl(semid[i], 0, IPC_RMID, (int) 0);
+        free(shmid);
+        free(semid);
+        for (int b = 0; b < 4; b++) remove(border_file[b]);
+    }
 
-    remove("worker-left");
-    remove("worker-right");
+    if (engine == ENGINE_HASHLIFE) hash_free(&hash);
+    if (listening) {
+        /* при выходе по сигналу поток приема еще ждет в msgrcv */
+        pthread_cancel(listener);
+        pthread_join(listener, NULL);
+    }
+    for (int m = 0; m < INBOX_SIZE; m++) free(inbox.msg[m].data);
+    free(pid_worker);
+    free(pid_worker_map_row);
+    free(pid_worker_map_col);
+    free(busy_seen);
 
     snd_client_message("OK: Server is OFF.");
     write_log(logfile, "Server is OFF.");
@@ -358,6 +1684,98 @@ void handler(int signo) {
     exit(1);
 }
 
+/**
+ * Разобрать необязательные ключи сервера:
+ *   - "-k <ядро>" — вычислительное ядро рабочих ("auto", "scalar",
+ * "sse2", "avx2", "avx512", "bits");
+ *   - "-g <глубина>" — глубина ореола, не больше высоты и ширины
+ * самого маленького блока;
+ *   - "-m <режим>" — "process" (по умолчанию): рабочие — отдельные
+ * процессы "life-worker", "thread": рабочие — потоки внутри сервера;
+ *   - "-b <период>" — перебалансировать блоки по измеренному времени
+ * рабочих каждые период поколений (0, по умолчанию, — не балансировать);
+ *   - "-e <движок>" — "grid" (по умолчанию): поколения строят рабочие,
+ * "hashlife": поколения строит сервер алгоритмом HashLife, размеры
+ * "вселенной" должны быть степенями двойки, "sparse": "вселенная" не
+ * ограничена и хранится чанками (см. "life-chunk.h"), а ее размеры
+ * задают окно скриншотов; перебалансировка в этом режиме не нужна;
+ *   - "-n <узел:порт>" — рабочие-процессы подключаются к серверу по TCP
+ * (см. "life-net.h"), узел — адрес сервера, видимый рабочим; только для
+ * движков "grid" и "hashlife" без перебалансировки;
+ *   - "-H <файл>" — команды запуска рабочих на других узлах для "-n";
+ *   - "-c <поколения>" — при поиске циклов сравнивать хеши "вселенной" не
+ * реже чем через столько поколений (по умолчанию 8; 0 — не искать
+ * циклы, например, при замерах производительности).
+ *
+ * @param[in] argc число параметров
+ * @param[in] argv параметры
+ * @return 0 при успехе, -1 при ошибке
+ */
+int server_options(int argc, char *argv[]) {
+    for (int i = 4; i < argc; i += 2) {
+        if (i+1 >= argc) return -1;
+
+        if (strcmp(argv[i], "-k") == 0) {
+            if (kernel_by_name(argv[i+1]) == -1) return -1;
+            kernel_name = argv[i+1];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-g") == 0) {
+            if (sscanf(argv[i+1], "%d", &G) != 1 || G < 1) return -1;
+            continue;
+        }
+
+        if (strcmp(argv[i], "-b") == 0) {
+            if (sscanf(argv[i+1], "%d", &balance) != 1 || balance < 0) return -1;
+            continue;
+        }
+
+        if (strcmp(argv[i], "-m") == 0) {
+            if (strcmp(argv[i+1], "thread") == 0) {
+                threaded = 1;
+            } else if (strcmp(argv[i+1], "process") == 0) {
+                threaded = 0;
+            } else return -1;
+            continue;
+        }
+
+        if (strcmp(argv[i], "-e") == 0) {
+            if (strcmp(argv[i+1], "hashlife") == 0) {
+                engine = ENGINE_HASHLIFE;
+            } else if (strcmp(argv[i+1], "sparse") == 0) {
+                engine = ENGINE_SPARSE;
+            } else if (strcmp(argv[i+1], "grid") == 0) {
+                engine = ENGINE_GRID;
+            } else return -1;
+            continue;
+        }
+
+        if (strcmp(argv[i], "-n") == 0) {
+            char host[NET_HOST_SIZE];
+            int port;
+            if (net_parse_addr(argv[i+1], host, &port) == -1) return -1;
+            net_addr = argv[i+1];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-H") == 0) {
+            net_hosts = argv[i+1];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-c") == 0) {
+            if (sscanf(argv[i+1], "%d", &cycle_every) != 1 || cycle_every < 0) return -1;
+            continue;
+        }
+        return -1;
+    }
+    if (net_addr && (threaded || engine == ENGINE_SPARSE || balance)) return -1;
+    if (engine == ENGINE_HASHLIFE && hash_init(&hash, M, N) == -1) return -1;
+    if (engine == ENGINE_SPARSE) balance = 0;
+    return 0;
+}
+
 /**
  * Основная функция сервера. Сервер
  *   -# получает параметры для вселенной,
@@ -365,9 +1783,10 @@ void handler(int signo) {
  */
 int main(int argc, char *argv[]) {
     signal(SIGTERM, handler);
+    signal(SIGPIPE, SIG_IGN);
     logfile = fopen("plife.log", "w");
 
-    if (argc != 4) {
+    if (argc < 4) {
         write_log(logfile, "Wrong number of parameters.");
         quit_message("ERROR: Wrong number of parameters.");
     }
@@ -376,35 +1795,99 @@ int main(int argc, char *argv[]) {
     sscanf(argv[2], "%d", &N);
     sscanf(argv[3], "%d", &K);
 
+    pid_client = getppid();
+    key = ftok("server", 's');
+    msgid = msgget(key, 0666);
+
+    if (server_options(argc, argv) == -1 || server_partition() == -1) {
+        snd_client_message("ERROR: Wrong server options.");
+        write_log(logfile, "Wrong server options.");
+        fclose(logfile);
+        return 1;
+    }
+
     server_init();
 
     pid_server = getpid();
-    pid_client = getppid();
 
     snd_client_message("OK: Server is ON.");
     write_log(logfile, "Server is ON.");
 
+    /* SIGTERM обрабатывает основной поток: обработчик ждет поток приема */
+    sigset_t set, old;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    pthread_create(&listener, NULL, server_listener, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    listening = 1;
+
     while (1) {
         if (steps > 0 && rcv_client_message(1) == -1) {
-            server_next_generation();
-            if (!(--steps)) write_log(logfile, "Simulation is finished.");
+            int gens;
+            server_flush_edits();
+            switch (engine) {
+                case ENGINE_HASHLIFE: gens = server_hash_generation(); break;
+                case ENGINE_SPARSE:   gens = server_sparse_generation(); break;
+                default:              gens = server_next_generation();
+            }
+            if (steps != STEPS_ENDLESS) steps -= gens;
+            server_cycle();
+            balance_gens += gens;
+            if (stream.file && generation % stream.every == 0) {
+                if (__atomic_load_n(&stream.failed, __ATOMIC_RELAXED)) {
+                    server_stream_close();
+                } else server_stream_frame();
+            }
+            if (balance && balance_gens >= balance && !cycle.period) {
+                server_rebalance();
+                balance_gens = 0;
+            }
+            if (!steps) write_log(logfile, "Simulation is finished.");
+            if (!steps && client_waiting) {
+                snd_client_reply(O_WAIT, client_waiting_seq, 0, 0, "OK", 2);
+                client_waiting = 0;
+            }
             continue;
         }
 
-        if (steps == 0) rcv_client_message(0);
+        if (steps == 0 && (!edits_pending || rcv_client_message(1) == -1)) {
+            server_flush_edits();
+            rcv_client_message(0);
+        }
+        if (request.op != O_ADD && request.op != O_DEL && request.op != O_CELLS) server_flush_edits();
 
-        if (message.op == O_QUIT) {
+        if (request.op == O_QUIT) {
             break;
         }
 
-        switch (message.op) {
-            case O_ADD:   server_add(message.prm1, message.prm2, 1); break;
-            case O_DEL:   server_add(message.prm1, message.prm2, 0); break;
+        uint64_t t0 = stats_now();
+        switch (request.op) {
+            case O_ADD:   server_add(request.prm1, request.prm2, 1); break;
+            case O_DEL:   server_add(request.prm1, request.prm2, 0); break;
+            case O_CELLS: server_cells(); break;
+            case O_LOAD:  server_load(request.prm1, request.prm2); break;
+            case O_SAVE:  server_save(); break;
+            case O_RESTORE: server_restore(); break;
             case O_CLEAR: server_clear(); break;
             case O_START: server_start(); break;
             case O_STOP:  server_stop(); break;
-            case O_SNAP:  server_snap(); break;
-            default: ;
+            case O_SNAP:  server_snap(request.prm2); break;
+            case O_WAIT:  server_wait(); break;
+            case O_STATS: server_stats(); break;
+            case O_RULE:  server_rule(); break;
+            case O_STREAM: server_stream(); break;
+            default:
+                snd_client_message("ERROR: Unsupported message.");
+                write_log(logfile, "Unsupported message.");
+        }
+        stats_add(&stats->phase[ST_CLIENT], stats_now() - t0);
+
+        /* после изменения "вселенной" или нового запуска прежние хеши не нужны */
+        switch (request.op) {
+            case O_ADD: case O_DEL: case O_CELLS: case O_LOAD: case O_RESTORE:
+            case O_CLEAR: case O_RULE: case O_START: case O_STREAM:
+                server_cycle_reset();
         }
     }
 
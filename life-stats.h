@@ -0,0 +1,126 @@
+/**
+ * @file life-stats.h
+ *
+ * Счетчики времени этапов построения поколений. Каждый рабочий и сервер
+ * ведут по одной структуре struct life_stats в управляющем сегменте
+ * (см. ctl_stats()); в каждую пишет только ее владелец, клиент читает
+ * все структуры по команде "stats". Длительности складываются в
+ * гистограммы с логарифмическими корзинами: корзина b содержит значения
+ * от 2^(b-1) до 2^b-1 нс, что позволяет оценить медиану и 99-й
+ * процентиль без хранения отдельных замеров.
+ */
+
+#ifndef LIFE_STATS_H
+#define LIFE_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/** @brief число корзин гистограммы */
+#define STATS_BUCKETS 48
+
+/** @brief этап рабочего: чтение ореола из границ соседей */
+#define ST_HALO     0
+/** @brief этап рабочего: смена карт перед поколением */
+#define ST_SWAP     1
+/** @brief этап рабочего: вычисление поколений */
+#define ST_COMPUTE  2
+/** @brief этап рабочего: ожидание, пока соседи прочитают границы */
+#define ST_SYNC     3
+/** @brief этап рабочего: запись собственных границ */
+#define ST_BORDER   4
+
+/** @brief этап сервера: рассылка команд O_START по кольцам */
+#define ST_DISPATCH 0
+/** @brief этап сервера: ожидание подтверждений рабочих */
+#define ST_ACKS     1
+/** @brief этап сервера: пакет поколений целиком */
+#define ST_BATCH    2
+/** @brief этап сервера: обработка команды клиента */
+#define ST_CLIENT   3
+
+/** @brief число этапов в структуре счетчиков */
+#define STATS_PHASES 5
+
+/** @brief гистограмма длительностей одного этапа */
+struct stats_hist {
+    /** @brief число замеров */
+    uint64_t count;
+    /** @brief суммарная длительность, нс */
+    uint64_t total;
+    /** @brief число замеров в каждой корзине */
+    uint64_t bucket[STATS_BUCKETS];
+};
+
+/** @brief счетчики рабочего или сервера */
+struct life_stats {
+    /** @brief число построенных поколений */
+    int64_t generations __attribute__((aligned(64)));
+    /** @brief число живых клеток блока (обновляется по команде O_STATS) */
+    int64_t live;
+    /** @brief рабочий: хеш блока после последнего пакета поколений, для
+     * которого сервер просил хеш (см. O_START); сервер: хеш "вселенной",
+     * собранный из хешей блоков */
+    uint64_t hash;
+    /** @brief сервер: период последнего найденного цикла (0, если цикл не
+     * найден) */
+    int64_t period;
+    /** @brief сервер: число поколений, пропущенных благодаря циклам */
+    int64_t skipped;
+    /** @brief гистограммы этапов (ST_HALO..ST_BORDER для рабочего,
+     * ST_DISPATCH..ST_CLIENT для сервера) */
+    struct stats_hist phase[STATS_PHASES];
+};
+
+/**
+ * Текущее время монотонных часов.
+ *
+ * @return время в наносекундах
+ */
+static inline uint64_t stats_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * Добавить замер в гистограмму.
+ *
+ * @param[in,out] h гистограмма
+ * @param[in] ns длительность, нс
+ */
+static inline void stats_add(struct stats_hist *h, uint64_t ns) {
+    int b = (ns) ? 64 - __builtin_clzll(ns): 0;
+    if (b >= STATS_BUCKETS) b = STATS_BUCKETS - 1;
+    h->bucket[b]++;
+    h->total += ns;
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Оценить процентиль длительности по гистограмме. Внутри корзины
+ * значения считаются распределенными равномерно.
+ *
+ * @param[in] h гистограмма
+ * @param[in] q доля замеров (0..1), например 0.5 или 0.99
+ * @return оценка процентиля, нс (0, если замеров нет)
+ */
+static inline double stats_percentile(const struct stats_hist *h, double q) {
+    uint64_t count = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) count += h->bucket[b];
+    if (!count) return 0;
+
+    double rank = q * count, seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        if (!h->bucket[b] || seen + h->bucket[b] < rank) {
+            seen += h->bucket[b];
+            continue;
+        }
+        double lo = (b) ? (double) (1ULL << (b-1)): 0;
+        double hi = (double) (1ULL << b);
+        return lo + (hi - lo) * (rank - seen) / h->bucket[b];
+    }
+    return (double) (1ULL << (STATS_BUCKETS-1));
+}
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * @file life-stream.c
+ *
+ * Запись потока кадров в отдельном потоке. Сервер заполняет свободный
+ * буфер без блокировки и только под мьютексом помечает его как ждущий
+ * записи; поток записи берет буферы по очереди, поэтому кадры попадают в
+ * файл по возрастанию поколений.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "life-stream.h"
+#include "life-pattern.h"
+
+/**
+ * Поток записи: ждать кадр, записать его и освободить буфер. После
+ * ошибки записи кадры освобождаются без записи.
+ *
+ * @param[in] arg поток кадров
+ */
+static void *stream_writer(void *arg) {
+    struct life_stream *s = (struct life_stream *) arg;
+    int i = 0;
+
+    pthread_mutex_lock(&s->lock);
+    while (1) {
+        while (s->slot[i].state != STREAM_QUEUED && !s->closing)
+            pthread_cond_wait(&s->cond, &s->lock);
+        if (s->slot[i].state != STREAM_QUEUED) break;
+
+        struct stream_slot *slot = &s->slot[i];
+        slot->state = STREAM_WRITING;
+        pthread_mutex_unlock(&s->lock);
+
+        if (!s->failed) {
+            fprintf(s->file, "#G %lld\n", (long long) slot->generation);
+            pattern_write_rle(s->file, slot->cells, s->rows, s->cols, slot->rule);
+            if (fflush(s->file) != 0) __atomic_store_n(&s->failed, 1, __ATOMIC_RELAXED);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        slot->state = STREAM_FREE;
+        if (!s->failed) s->written++;
+        i = 1 - i;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+int stream_open(struct life_stream *s, const char *path, int rows, int cols, int every) {
+    memset(s, 0, sizeof(struct life_stream));
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+    if (fd == -1) return -1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    s->file = fdopen(fd, "w");
+    s->slot[0].cells = malloc((size_t) rows * cols);
+    s->slot[1].cells = malloc((size_t) rows * cols);
+    if (!s->file || !s->slot[0].cells || !s->slot[1].cells) {
+        if (s->file) {
+            fclose(s->file);
+        } else close(fd);
+        free(s->slot[0].cells);
+        free(s->slot[1].cells);
+        s->file = NULL;
+        return -1;
+    }
+
+    s->rows  = rows;
+    s->cols  = cols;
+    s->every = every;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    pthread_create(&s->thread, NULL, stream_writer, s);
+    return 0;
+}
+
+int stream_push(struct life_stream *s, const char *cells, int64_t generation, const char *rule) {
+    struct stream_slot *slot = &s->slot[s->next];
+
+    pthread_mutex_lock(&s->lock);
+    int state = slot->state;
+    pthread_mutex_unlock(&s->lock);
+    if (state != STREAM_FREE) {
+        s->dropped++;
+        return -1;
+    }
+
+    memcpy(slot->cells, cells, (size_t) s->rows * s->cols);
+    slot->generation = generation;
+    strncpy(slot->rule, rule, sizeof(slot->rule) - 1);
+
+    pthread_mutex_lock(&s->lock);
+    slot->state = STREAM_QUEUED;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    s->next = 1 - s->next;
+    return 0;
+}
+
+void stream_close(struct life_stream *s) {
+    if (!s->file) return;
+
+    pthread_mutex_lock(&s->lock);
+    s->closing = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    fclose(s->file);
+    free(s->slot[0].cells);
+    free(s->slot[1].cells);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    s->file = NULL;
+}
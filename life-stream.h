@@ -0,0 +1,107 @@
+/**
+ * @file life-stream.h
+ *
+ * Поток кадров "вселенной" в файл или канал FIFO во время моделирования
+ * (команда "stream"). Кадры записываются в формате RLE, перед каждым
+ * кадром стоит строка "#G <номер поколения>", поэтому файл — это
+ * последовательность образцов, которую можно разбирать по одному.
+ *
+ * Кадры записывает отдельный поток. У потока два буфера кадра: пока
+ * один записывается, сервер может поставить в очередь второй. Если оба
+ * заняты, кадр пропускается и учитывается в счетчике пропусков, чтобы
+ * запись никогда не задерживала построение поколений. Модуль не
+ * использует IPC и работает только с переданными ему картами клеток.
+ */
+
+#ifndef LIFE_STREAM_H
+#define LIFE_STREAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/** @brief буфер кадра свободен */
+#define STREAM_FREE    0
+/** @brief кадр ждет записи */
+#define STREAM_QUEUED  1
+/** @brief кадр записывается */
+#define STREAM_WRITING 2
+
+/** @brief буфер кадра */
+struct stream_slot {
+    /** @brief карта rows x cols ('*' / '.'), строки подряд */
+    char *cells;
+    /** @brief номер поколения кадра */
+    int64_t generation;
+    /** @brief правило в записи B/S */
+    char rule[32];
+    /** @brief состояние буфера: STREAM_FREE, STREAM_QUEUED, STREAM_WRITING */
+    int state;
+};
+
+/** @brief поток кадров */
+struct life_stream {
+    /** @brief файл, в который записываются кадры (NULL — поток закрыт) */
+    FILE *file;
+    /** @brief поток записи */
+    pthread_t thread;
+    /** @brief защищает состояния буферов и флаг закрытия */
+    pthread_mutex_t lock;
+    /** @brief сигнализирует о новом кадре или закрытии */
+    pthread_cond_t cond;
+    /** @brief два буфера кадра */
+    struct stream_slot slot[2];
+    /** @brief буфер, в который будет поставлен следующий кадр */
+    int next;
+    /** @brief поток закрывается: записать оставшиеся кадры и выйти */
+    int closing;
+    /** @brief число клеток по вертикали */
+    int rows;
+    /** @brief число клеток по горизонтали */
+    int cols;
+    /** @brief период кадров в поколениях */
+    int every;
+    /** @brief число записанных кадров */
+    long written;
+    /** @brief число пропущенных кадров */
+    long dropped;
+    /** @brief запись завершилась ошибкой (например, читатель канала вышел);
+     * сервер закрывает такой поток при следующем кадре */
+    int failed;
+};
+
+/**
+ * Открыть поток кадров: открыть файл на запись и запустить поток записи.
+ * Канал FIFO открывается без ожидания, поэтому у него уже должен быть
+ * читатель.
+ *
+ * @param[out] s поток кадров
+ * @param[in] path путь к файлу или каналу
+ * @param[in] rows число клеток по вертикали
+ * @param[in] cols число клеток по горизонтали
+ * @param[in] every период кадров в поколениях
+ * @return 0 при успехе, -1, если файл не удалось открыть
+ */
+int stream_open(struct life_stream *s, const char *path, int rows, int cols, int every);
+
+/**
+ * Поставить кадр в очередь записи. Карта копируется, поэтому после
+ * возврата ее можно менять.
+ *
+ * @param[in,out] s поток кадров
+ * @param[in] cells карта rows x cols, строки подряд
+ * @param[in] generation номер поколения
+ * @param[in] rule правило в записи B/S
+ * @return 0, если кадр поставлен в очередь, -1, если он пропущен
+ */
+int stream_push(struct life_stream *s, const char *cells, int64_t generation, const char *rule);
+
+/**
+ * Закрыть поток кадров: дождаться записи кадров из очереди, остановить
+ * поток записи и закрыть файл.
+ *
+ * @param[in,out] s поток кадров
+ */
+void stream_close(struct life_stream *s);
+
+#endif
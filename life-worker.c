@@ -7,191 +7,984 @@
  */
 
 #include "life.h"
+#include "life-ring.h"
+#include "life-fb.h"
+#include "life-ckpt.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "life-kernel.h"
+#include "life-worker.h"
+#include "life-net.h"
+
+#ifdef LIFE_WORKER_THREAD
+/** @brief глобальные переменные рабочего-потока принадлежат потоку */
+#define WORKER_LOCAL static __thread
+#else
+#define WORKER_LOCAL
+#endif
 
 /** @brief число клеток области по вертикали */
-int M = -1;
+WORKER_LOCAL int M = -1;
 /** @brief число клеток области по горизонтали */
-int N = -1;
+WORKER_LOCAL int N = -1;
 /** @brief число процессов-рабочих */
-int K = -1;
+WORKER_LOCAL int K = -1;
+/** @brief число клеток "вселенной" по вертикали */
+WORKER_LOCAL int rows_total = -1;
+/** @brief число клеток "вселенной" по горизонтали */
+WORKER_LOCAL int cols_total = -1;
+/** @brief число рядов блоков */
+WORKER_LOCAL int Py = 1;
+/** @brief число колонок блоков */
+WORKER_LOCAL int Px = 1;
+/** @brief ряд блока рабочего */
+WORKER_LOCAL int block_row = 0;
+/** @brief колонка блока рабочего */
+WORKER_LOCAL int block_col = 0;
+/** @brief глубина ореола: число строк и столбцов, получаемых от каждого
+ * соседа, и наибольшее число поколений, строящихся без обмена границами */
+WORKER_LOCAL int G = 1;
 /** @brief индекс рабочего */
-int id_worker = -1;
-/** @brief индекс левого соседа рабочего */
-int id_collab_left = -1;
-/** @brief индекс правого соседа рабочего */
-int id_collab_right = -1;
-/** @brief идентификатор процесса-рабочего */
-pid_t pid_worker = -1;
-/** @brief идентификатор процесса-сервера */
-pid_t pid_server = -1;
-
-/** @brief карта текущего состояния "вселенной" */
-char **map_state_curr = NULL;
+WORKER_LOCAL int id_worker = -1;
+/** @brief номер первой строки блока во "вселенной" (с нуля) */
+WORKER_LOCAL int row_first = 0;
+/** @brief номер первого столбца блока во "вселенной" (с нуля) */
+WORKER_LOCAL int col_first = 0;
+
+/** @brief карта текущего состояния "вселенной"
+ *
+ * Карта состоит из M+2G строк по N+2G клеток: собственные клетки блока
+ * имеют номера строк G..M+G-1 и столбцов G..N+G-1, по G строк и
+ * столбцов с каждой стороны занимает ореол. */
+WORKER_LOCAL char **map_state_curr = NULL;
 /** @brief карта последнего смоделированного состояния "вселенной" */
-char **map_state_prev = NULL;
+WORKER_LOCAL char **map_state_prev = NULL;
+
+/** @brief вычислительное ядро рабочего (KERNEL_SCALAR, KERNEL_BITS,
+ * KERNEL_SSE2, KERNEL_AVX2, KERNEL_AVX512) */
+WORKER_LOCAL int kernel = KERNEL_SCALAR;
+/** @brief правило, по которому строятся поколения (по умолчанию —
+ * правило Конвея, меняется командой O_RULE) */
+WORKER_LOCAL struct kernel_rule rule;
+/** @brief упакованная карта текущего состояния "вселенной" */
+WORKER_LOCAL uint64_t **bits_state_curr = NULL;
+/** @brief упакованная карта последнего смоделированного состояния */
+WORKER_LOCAL uint64_t **bits_state_prev = NULL;
+/** @brief общая память обеих карт (см. worker_alloc_grids()) */
+WORKER_LOCAL char *grid_base = NULL;
+/** @brief размер общей памяти карт в байтах */
+WORKER_LOCAL size_t grid_size = 0;
+
+/** @brief размер памяти карт, начиная с которого она отображается на
+ * большие страницы */
+#define GRID_HUGE_PAGE (2 << 20)
+
+#ifndef WORKER_TILE
+/** @brief сторона плитки карты в клетках (упакованное ядро строит строки
+ * целиком, поэтому его плитки занимают всю ширину карты) */
+#define WORKER_TILE 64
+#endif
+
+/** @brief число рядов плиток карты */
+WORKER_LOCAL int tile_rows = 0;
+/** @brief число колонок плиток карты */
+WORKER_LOCAL int tile_cols = 0;
+/** @brief ширина плитки в клетках */
+WORKER_LOCAL int tile_width = WORKER_TILE;
+/** @brief признаки плиток текущей карты, которые могут отличаться от
+ * плиток последней смоделированной карты
+ *
+ * Плитка строится заново, только если изменилась она сама или одна из
+ * соседних плиток: иначе новое поколение плитки совпадает с тем, что уже
+ * лежит в карте, на место которой оно записывается (см. worker_step()).
+ * Признаки меняются местами вместе с картами. */
+WORKER_LOCAL char *tile_curr = NULL;
+/** @brief признаки плиток последней смоделированной карты */
+WORKER_LOCAL char *tile_prev = NULL;
+/** @brief признаки плиток, изменившихся хотя бы в одном поколении
+ * текущего пакета; по ним рабочий пропускает запись неизменных границ */
+WORKER_LOCAL char *tile_moved = NULL;
 
+/** @brief сегмент чанков разреженной "вселенной" или NULL, если рабочий
+ * строит поколения на карте блока (см. "life-chunk.h") */
+WORKER_LOCAL struct life_chunks *chunks = NULL;
+/** @brief часть сегмента чанков, принадлежащая рабочему */
+WORKER_LOCAL struct chunk_part *part = NULL;
+/** @brief стек свободных мест для чанков */
+WORKER_LOCAL int *chunk_free = NULL;
+/** @brief число свободных мест в стеке */
+WORKER_LOCAL int chunk_free_count = 0;
+/** @brief число мест, которые когда-либо занимались (остальные
+ * просматривать не нужно) */
+WORKER_LOCAL int chunk_top = 0;
+/** @brief новое поколение чанков построено, но буферы еще не сменены */
+WORKER_LOCAL int chunk_pending = 0;
+/** @brief строки отсутствующего чанка */
+static const uint64_t chunk_zero[CHUNK_SIZE];
+
+/** @brief адрес сервера "узел:порт" для сетевого транспорта (ключ "-n")
+ * или NULL, если рабочий работает через разделяемую память */
+WORKER_LOCAL char *net_server = NULL;
+/** @brief соединение с сервером (-1 — сетевой транспорт не используется) */
+WORKER_LOCAL int net_fd = -1;
+/** @brief соединения с соседями по номерам рабочих (-1 — нет) */
+WORKER_LOCAL int *net_link = NULL;
+/** @brief последняя команда сервера вместе с содержимым */
+WORKER_LOCAL struct net_msg net_cmd;
+/** @brief границы, изменившиеся после последней отправки соседям */
+WORKER_LOCAL char border_dirty[4];
+
+/** @brief левая граница рабочего */
+#define B_LEFT   0
+/** @brief правая граница рабочего */
+#define B_RIGHT  1
+/** @brief верхняя граница рабочего */
+#define B_TOP    2
+/** @brief нижняя граница рабочего */
+#define B_BOTTOM 3
+/** @brief правая граница западного соседа */
+#define H_WEST   4
+/** @brief левая граница восточного соседа */
+#define H_EAST   5
+/** @brief нижняя граница северного соседа */
+#define H_NORTH  6
+/** @brief верхняя граница южного соседа */
+#define H_SOUTH  7
+/** @brief нижняя граница северо-западного соседа */
+#define H_NW     8
+/** @brief нижняя граница северо-восточного соседа */
+#define H_NE     9
+/** @brief верхняя граница юго-западного соседа */
+#define H_SW    10
+/** @brief верхняя граница юго-восточного соседа */
+#define H_SE    11
+/** @brief число сегментов разделяемой памяти, с которыми работает рабочий */
+#define SEGMENTS 12
+
+/** @brief смещение соседа по рядам блоков для сегментов H_WEST..H_SE */
+static const int halo_dr[8] = { 0, 0, -1, 1, -1, -1, 1, 1};
+/** @brief смещение соседа по колонкам блоков для сегментов H_WEST..H_SE */
+static const int halo_dc[8] = {-1, 1, 0, 0, -1, 1, -1, 1};
+/** @brief граница соседа, из которой читается сегмент H_WEST..H_SE */
+static const int halo_border[8] = {B_RIGHT, B_LEFT, B_BOTTOM, B_TOP, B_BOTTOM, B_BOTTOM, B_TOP, B_TOP};
+
+/** @brief управляющий сегмент, общий для сервера и рабочих */
+WORKER_LOCAL struct life_ctl *ctl = NULL;
+/** @brief кольцо команд рабочего */
+WORKER_LOCAL struct ring *ring = NULL;
+/** @brief общий кадр "вселенной" для скриншотов */
+WORKER_LOCAL struct life_fb *fb = NULL;
+/** @brief счетчики этапов рабочего в управляющем сегменте */
+WORKER_LOCAL struct life_stats *stats = NULL;
+/** @brief последняя принятая команда */
+WORKER_LOCAL struct ring_cmd command;
+/** @brief массив указателей на начало границ
+ *
+ * Элементы B_LEFT..B_BOTTOM относятся к собственным границам рабочего,
+ * элементы H_WEST..H_SE — к границам соседей, из которых читается ореол.
+ * Верхняя и нижняя границы хранят G строк по N клеток (строка k занимает
+ * байты k*N..(k+1)*N-1), левая и правая — G столбцов по M клеток.
+ * Читатель границы поднимает ее семафор, а владелец перед записью
+ * опускает его на число читателей (см. worker_readers()).
+ * */
+WORKER_LOCAL char *shmad[SEGMENTS];
+/** @brief ширина блоков западного (0) и восточного (1) соседей */
+WORKER_LOCAL int width_collab[2];
+#ifdef LIFE_WORKER_THREAD
+/** @brief семафоры границ в многопоточном режиме (нумерация как у
+ * shmad) */
+WORKER_LOCAL struct fsem *fsem[SEGMENTS];
+/** @brief параметры рабочего-потока */
+WORKER_LOCAL struct worker_arg *thread_arg;
+#else
 /** @brief IPC-ключ */
 key_t key = 0;
-/** @brief идентификатор очереди сообщений */
-int msgid;
-/** @brief массив идентификаторов семафоров
- * -# semid[0] - правая граница левого соседа рабочего;
- * -# semid[1] - левая граница рабочего;
- * -# semid[2] - правая граница рабочего;
- * -# semid[3] - левая граница правого соседа рабочего;
- * */
-int semid[4];
-/** @brief массив идентификаторов разделяемой памяти
- * -# semid[0] - правая граница левого соседа рабочего;
- * -# semid[1] - левая граница рабочего;
- * -# semid[2] - правая граница рабочего;
- * -# semid[3] - левая граница правого соседа рабочего;
- * */
-int shmid[4];
+/** @brief рабочий строит разреженную "вселенную" (ключ "-e sparse") */
+int sparse = 0;
+/** @brief массив идентификаторов семафоров (нумерация как у shmad) */
+int semid[SEGMENTS];
+/** @brief массив идентификаторов разделяемой памяти (нумерация как у
+ * shmad) */
+int shmid[SEGMENTS];
 /** @brief массив для управления семафорами */
-struct sembuf sops[4];
-/** @brief массив указатель на начало адресного пространства
- разделяемой памяти */
-char *shmad[4];
+struct sembuf sops[SEGMENTS];
+/** @brief файлы, по которым строятся IPC-ключи границ (нумерация как у
+ * B_LEFT..B_BOTTOM) */
+char *border_file[4] = {"worker-left", "worker-right", "worker-top", "worker-bottom"};
+#endif
 
 /**
  * Рабочий сообщает о том, что он выполнил операцию, посланную сервером.
- *
- * @return При успешном завершении возвращает 0, а при ошибке — -1, и в
- * переменную errno записывается код ошибки.
+ * При сетевом транспорте вместе с подтверждением отправляются данные
+ * (блок для O_SNAP, счетчики для O_STATS), которые в разделяемой памяти
+ * сервер читает сам.
+ * @param[in] data данные подтверждения
+ * @param[in] len длина данных
  */
-int worker_is_ready(void) {
-    message.mtype = worker_being_ready;
-    return msgsnd(msgid, (struct msgbuf*)(&message), sizeof(message), 0);
+void worker_reply(const void *data, uint32_t len) {
+    if (net_fd != -1) {
+        net_send(net_fd, command.op, command.prm1, 0, data, len);
+    } else ctl_ack(ctl);
 }
 
 /**
- * Принять сообщение от сервера.
- *
- * @param[in] c включает флаг IPC_NOWAIT
- * @return При успешном завершении системный вызов возвращает
- * действительную длину сообщения, скопированного в поле mtext. При
- * ошибке возвращается -1, а в переменную errno записывается код ошибки.
+ * Рабочий сообщает о том, что он выполнил операцию, посланную сервером.
  */
-ssize_t rcv_server_message(char c) {
-    return msgrcv(msgid, (struct msgbuf*)(&message), sizeof(message), pid_worker, c*IPC_NOWAIT);
+void worker_is_ready(void) {
+    worker_reply(NULL, 0);
 }
 
 /**
- * Принять информационное сообщение от сервера.
- *
- * @return При успешном завершении системный вызов возвращает
- * действительную длину сообщения, скопированного в поле mtext. При
- * ошибке возвращается -1, а в переменную errno записывается код ошибки.
+ * Принять команду от сервера, при необходимости дождавшись ее. Если
+ * соединение с сервером разорвано, рабочий завершает работу.
  */
-ssize_t rcv_worker_info(void) {
-    ssize_t p = rcv_server_message(0);
-    id_worker = message.op;
-    M = message.prm1;
-    N = message.prm2;
-    return p;
+void rcv_server_command(void) {
+    if (net_fd == -1) {
+        command = ring_pop(ring);
+        return;
+    }
+
+    if (net_recv(net_fd, &net_cmd) == -1) {
+        command.op = O_QUIT;
+        return;
+    }
+    command.op   = net_cmd.hdr.op;
+    command.prm1 = net_cmd.hdr.prm1;
+    command.prm2 = net_cmd.hdr.prm2;
 }
 
 /**
- * Отправить сообщение серверу.
- *
- * @return При успешном завершении возвращает 0, а при ошибке — -1, и в
- * переменную errno записывается код ошибки.
+ * Вычислить размеры и положение блока рабочего по границам рядов и
+ * колонок блоков, записанным сервером в управляющий сегмент.
+ */
+void worker_geometry(void) {
+    int *rs = ctl_row_split(ctl), *cs = ctl_col_split(ctl);
+    int west = (block_col+Px-1) % Px, east = (block_col+1) % Px;
+
+    row_first = rs[block_row];
+    col_first = cs[block_col];
+    M = rs[block_row+1] - rs[block_row];
+    N = cs[block_col+1] - cs[block_col];
+    width_collab[0] = cs[west+1] - cs[west];
+    width_collab[1] = cs[east+1] - cs[east];
+}
+
+void worker_net_connect(void);
+
+/**
+ * Подключить управляющий сегмент и кадр скриншотов и прочитать размеры
+ * "вселенной". Размеры блока рабочего вычисляются по ним так же, как это
+ * делает сервер. При сетевом транспорте управляющий сегмент заменяется
+ * локальной копией, заполненной по NET_INFO, а кадра нет.
  */
-int snd_server_message(void) {
-    message.mtype = pid_server;
-    return msgsnd(msgid, (struct msgbuf*)(&message), sizeof(message), 0);
+void rcv_worker_info(void) {
+    if (net_server) {
+        worker_net_connect();
+    } else {
+#ifdef LIFE_WORKER_THREAD
+    ctl = thread_arg->ctl;
+    fb  = thread_arg->fb;
+    chunks = thread_arg->chunks;
+#else
+    key = ftok("server", 'c');
+    ctl = shmat(shmget(key, 0, 0666), NULL, 0);
+
+    key = ftok("server", 'f');
+    fb = shmat(shmget(key, 0, 0666), NULL, 0);
+
+    if (sparse) {
+        key = ftok("server", 'h');
+        chunks = shmat(shmget(key, 0, 0666), NULL, 0);
+    }
+#endif
+    }
+    ring  = ctl_ring(ctl, id_worker);
+    stats = ctl_stats(ctl, id_worker);
+
+    rows_total = ctl->rows;
+    cols_total = ctl->cols;
+
+    block_row = id_worker / Px;
+    block_col = id_worker % Px;
+    worker_geometry();
 }
 
 /**
- * Определить индексы соседей рабочего.
- * @param[in] i индекс рабочего
+ * Определить индекс соседа рабочего с учетом замкнутости "вселенной".
+ * @param[in] dr смещение по рядам блоков (-1, 0, 1)
+ * @param[in] dc смещение по колонкам блоков (-1, 0, 1)
+ * @return индекс соседа
  */
-void worker_define_partners(int i) {
-    if (K == 1) {
-        id_collab_left  = 0;
-        id_collab_right = 0;
+int worker_partner(int dr, int dc) {
+    int r = (block_row + dr + Py) % Py;
+    int c = (block_col + dc + Px) % Px;
+    return r*Px + c;
+}
+
+/**
+ * Подключиться к серверу по сетевому транспорту (см. "life-net.h"):
+ * сообщить свой номер и порт для соседей, получить размеры "вселенной",
+ * границы блоков и адреса рабочих, заполнить ими локальный управляющий
+ * сегмент и установить соединения с соседями.
+ */
+void worker_net_connect(void) {
+    char host[NET_HOST_SIZE];
+    int port, own = 0;
+
+    int lfd = net_listen(&own);
+    if (net_parse_addr(net_server, host, &port) == -1 || lfd == -1 ||
+        (net_fd = net_connect(host, port)) == -1 ||
+        net_send(net_fd, NET_HELLO, id_worker, own, NULL, 0) == -1 ||
+        net_recv(net_fd, &net_cmd) == -1 || net_cmd.hdr.op != NET_INFO)
+        quit_message("ERROR: Can't connect to the server.");
+
+    ctl = (struct life_ctl *) calloc(1, ctl_size(K));
+    ctl->rows    = net_cmd.hdr.prm1;
+    ctl->cols    = net_cmd.hdr.prm2;
+    ctl->workers = K;
+    int *split = (int *) net_cmd.data;
+    memcpy(ctl_row_split(ctl), split, (Py+1) * sizeof(int));
+    memcpy(ctl_col_split(ctl), split + Py+1, (Px+1) * sizeof(int));
+    struct net_addr *addr = (struct net_addr *) (split + Py+1 + Px+1);
+
+    block_row = id_worker / Px;
+    block_col = id_worker % Px;
+    net_link = (int *) malloc(K * sizeof(int));
+    for (int i = 0; i < K; i++) net_link[i] = -1;
+
+    int accepts = 0;
+    for (int s = 0; s < 8; s++) {
+        int p = worker_partner(halo_dr[s], halo_dc[s]);
+        if (p == id_worker || net_link[p] != -1) continue;
+        if (p > id_worker) {
+            net_link[p] = -2;
+            accepts++;
+            continue;
+        }
+        net_link[p] = net_connect(addr[p].host, addr[p].port);
+        if (net_link[p] == -1 || net_send(net_link[p], NET_HELLO, id_worker, 0, NULL, 0) == -1)
+            quit_message("ERROR: Can't connect to a neighbour.");
+    }
+
+    struct net_msg hello = {{0, 0, 0, 0}, NULL, 0};
+    for (int k = 0; k < accepts; k++) {
+        int fd = net_accept(lfd, NET_ACCEPT_TIMEOUT, NULL);
+        if (fd == -1 || net_recv(fd, &hello) == -1 || hello.hdr.op != NET_HELLO ||
+            hello.hdr.prm1 < 0 || hello.hdr.prm1 >= K || net_link[hello.hdr.prm1] != -2)
+            quit_message("ERROR: Can't accept a neighbour.");
+        net_link[hello.hdr.prm1] = fd;
+    }
+    free(hello.data);
+    close(lfd);
+
+    for (int i = 0; i < K; i++) {
+        if (net_link[i] >= 0) fcntl(net_link[i], F_SETFL, fcntl(net_link[i], F_GETFL) | O_NONBLOCK);
+    }
+}
+
+/**
+ * Число соседей, читающих данную границу рабочего: верхнюю и нижнюю
+ * границы читают три соседа (включая угловых), левую и правую — один.
+ * @param[in] b граница (B_LEFT..B_BOTTOM)
+ * @return число читателей
+ */
+int worker_readers(int b) {
+    return (b == B_TOP || b == B_BOTTOM) ? 3: 1;
+}
+
+/**
+ * Подключить разделяемую память и семафор границы. В многопоточном
+ * режиме граница и ее семафор берутся из памяти сервера. При сетевом
+ * транспорте собственные границы выделяются в памяти рабочего, а
+ * границы соседей приходят при обмене (см. worker_net_exchange()); если
+ * сосед — сам рабочий, сегмент совпадает с его собственной границей.
+ * @param[in] s номер сегмента (B_LEFT..H_SE)
+ * @param[in] b вид границы (B_LEFT..B_BOTTOM)
+ * @param[in] id индекс рабочего-владельца границы
+ */
+void worker_attach(int s, int b, int id) {
+    if (net_fd != -1) {
+        if (s == b) {
+            shmad[s] = (char *) malloc(G * ((b == B_LEFT || b == B_RIGHT) ? M: N));
+        } else shmad[s] = (id == id_worker) ? shmad[b]: NULL;
         return;
     }
+#ifdef LIFE_WORKER_THREAD
+    shmad[s] = thread_arg->band[4*id + b];
+    fsem[s]  = &thread_arg->sem[4*id + b];
+#else
+    key = ftok(border_file[b], id);
+    semid[s] = semget(key, 1, 0666);
+    shmid[s] = shmget(key, 0, 0666);
+    shmad[s] = shmat(shmid[s], NULL, 0);
+
+    sops[s].sem_num = 0;
+    sops[s].sem_flg = 0;
+#endif
+}
+
+/**
+ * Узнать состояние клетки текущего поколения.
+ * @param[in] x номер строки
+ * @param[in] y номер столбца
+ * @return '*' для живой клетки, '.' для мертвой
+ */
+char worker_get_cell(int x, int y) {
+    if (kernel == KERNEL_BITS) return kernel_bits_get(bits_state_curr[x], y);
+    return map_state_curr[x][y];
+}
+
+/**
+ * Изменить состояние клетки текущего поколения.
+ * @param[in] x номер строки
+ * @param[in] y номер столбца
+ * @param[in] c '*' для живой клетки, '.' для мертвой
+ */
+void worker_set_cell(int x, int y, char c) {
+    if (kernel == KERNEL_BITS) {
+        kernel_bits_set(bits_state_curr[x], y, c);
+    } else map_state_curr[x][y] = c;
+}
+
+/**
+ * Пометить плитки текущей карты как измененные.
+ * @param[in] all 1 — все плитки (карта заполнена заново или сменилось
+ * правило), 0 — ни одной
+ */
+void worker_touch_tiles(int all) {
+    memset(tile_curr, all, tile_rows * tile_cols);
+}
+
+/**
+ * Пометить плитку текущей карты, в которой лежит клетка, как измененную.
+ * @param[in] x номер строки карты
+ * @param[in] y номер столбца карты
+ */
+void worker_touch_cell(int x, int y) {
+    tile_curr[(x / WORKER_TILE) * tile_cols + y / tile_width] = 1;
+}
+
+/**
+ * Записать клетку ореола в текущую карту. Если клетка отличается от
+ * клетки последней смоделированной карты, которая после смены карт
+ * станет текущей, ее плитка помечается.
+ * @param[in] x номер строки карты
+ * @param[in] y номер столбца карты
+ * @param[in] c '*' для живой клетки, '.' для мертвой
+ */
+void worker_set_halo(int x, int y, char c) {
+    char old = (kernel == KERNEL_BITS) ? kernel_bits_get(bits_state_prev[x], y): map_state_prev[x][y];
+    if (c != old) worker_touch_cell(x, y);
+    worker_set_cell(x, y, c);
+}
 
-    if (i == 0) {
-        id_collab_left  = K-1;
-        id_collab_right = i+1;
+/**
+ * Выделить память под две карты из rows строк по bytes байт одним
+ * непрерывным анонимным отображением: сначала строки текущей карты,
+ * затем строки второй. Строки выровнены по 64 байтам. Если память карт
+ * не меньше GRID_HUGE_PAGE, ядро просят отобразить ее на большие
+ * страницы. Отображение заполнено нулями.
+ * @param[in] rows число строк карты
+ * @param[in] bytes длина строки в байтах
+ * @param[out] stride расстояние между началами соседних строк
+ * @return начало первой строки текущей карты
+ */
+char *worker_alloc_grids(int rows, size_t bytes, size_t *stride) {
+    *stride = (bytes + 63) / 64 * 64;
+    grid_size = 2 * (size_t) rows * *stride;
+    grid_base = mmap(NULL, grid_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+    if (grid_size >= GRID_HUGE_PAGE) madvise(grid_base, grid_size, MADV_HUGEPAGE);
+#endif
+    return grid_base;
+}
+
+/**
+ * Подключить границы блока и соседей и выделить память под карты и
+ * признаки плиток по текущим размерам блока. Карты и собственные границы
+ * очищаются, все плитки помечаются как измененные.
+ */
+void worker_setup(void) {
+    worker_attach(B_LEFT,   B_LEFT,   id_worker);
+    worker_attach(B_RIGHT,  B_RIGHT,  id_worker);
+    worker_attach(B_TOP,    B_TOP,    id_worker);
+    worker_attach(B_BOTTOM, B_BOTTOM, id_worker);
+    for (int s = H_WEST; s <= H_SE; s++)
+        worker_attach(s, halo_border[s-H_WEST], worker_partner(halo_dr[s-H_WEST], halo_dc[s-H_WEST]));
+
+    memset(shmad[B_LEFT],   '.', G*M);
+    memset(shmad[B_RIGHT],  '.', G*M);
+    memset(shmad[B_TOP],    '.', G*N);
+    memset(shmad[B_BOTTOM], '.', G*N);
+    memset(border_dirty, 1, sizeof(border_dirty));
+
+    size_t stride;
+    if (kernel == KERNEL_BITS) {
+        int words = kernel_bits_words(N+2*G);
+        char *base = worker_alloc_grids(M+2*G, words * sizeof(uint64_t), &stride);
+        bits_state_curr = (uint64_t **) calloc(M+2*G, sizeof(uint64_t *));
+        bits_state_prev = (uint64_t **) calloc(M+2*G, sizeof(uint64_t *));
+
+        for (int i = 0; i < M+2*G; i++) {
+            bits_state_curr[i] = (uint64_t *) (base + i * stride);
+            bits_state_prev[i] = (uint64_t *) (base + (M+2*G+i) * stride);
+        }
     } else {
-        if (i == K-1) {
-            id_collab_left  = i-1;
-            id_collab_right = 0;
-        } else {
-            id_collab_left  = i-1;
-            id_collab_right = i+1;
+        char *base = worker_alloc_grids(M+2*G, N+2*G, &stride);
+        map_state_curr = (char **) calloc(M+2*G, sizeof(char *));
+        map_state_prev = (char **) calloc(M+2*G, sizeof(char *));
+
+        memset(base, '.', grid_size);
+        for (int i = 0; i < M+2*G; i++) {
+            map_state_curr[i] = base + i * stride;
+            map_state_prev[i] = base + (M+2*G+i) * stride;
         }
     }
+
+    tile_width = (kernel == KERNEL_BITS) ? N+2*G: WORKER_TILE;
+    tile_rows  = (M+2*G + WORKER_TILE-1) / WORKER_TILE;
+    tile_cols  = (N+2*G + tile_width-1) / tile_width;
+    tile_curr  = (char *) calloc(tile_rows * tile_cols, 1);
+    tile_prev  = (char *) calloc(tile_rows * tile_cols, 1);
+    tile_moved = (char *) calloc(tile_rows * tile_cols, 1);
+    worker_touch_tiles(1);
 }
 
 /**
- * Инициализация рабочего. Рабочий
- *   -# подключает очередь сообщений, семафоры и разделяемую память;
- *   -# динамически выделяет память под массивы, описанные в глобальной
- * области кода;
- *   -# очищает таблицу текущего состояния.
+ * Подготовить стек свободных мест для чанков: сначала занимаются места с
+ * меньшими номерами, поэтому страницы сегмента заполняются по мере роста
+ * числа чанков.
  */
-void worker_init(void) {
-    pid_server = getppid();
-    pid_worker = getpid();
+void worker_sparse_setup(void) {
+    part = chunks_part(chunks, id_worker);
+    chunk_free = (int *) calloc(CHUNK_CAPACITY, sizeof(int));
+    for (int s = 0; s < CHUNK_CAPACITY; s++) chunk_free[s] = CHUNK_CAPACITY-1-s;
+    chunk_free_count = CHUNK_CAPACITY;
+}
+
+/**
+ * Добавить чанк в хеш-таблицу рабочего.
+ * @param[in] s место чанка
+ */
+void worker_sparse_insert(int s) {
+    struct chunk *c = &part->chunk[s];
+    uint32_t h = chunk_hash(c->cx, c->cy) & (CHUNK_TABLE-1);
+    while (part->table[h]) h = (h+1) & (CHUNK_TABLE-1);
+    part->table[h] = s+1;
+}
 
-    key = ftok("server", 's');
-    msgid = msgget(key, 0666);
+/**
+ * Найти чанк рабочего или занять для него место; оба буфера нового чанка
+ * пусты.
+ * @param[in] cx номер чанка по вертикали
+ * @param[in] cy номер чанка по горизонтали
+ * @return чанк или NULL, если свободных мест нет
+ */
+struct chunk *worker_sparse_alloc(int cx, int cy) {
+    struct chunk *c = chunk_find(part, cx, cy);
+    if (c) return c;
 
-    rcv_worker_info();
-    worker_define_partners(id_worker);
-
-    for (int i = 0; i < 4; i++) {
-        switch (i) {
-            case 0: key = ftok("worker-right", id_collab_left);  break;
-            case 1: key = ftok("worker-left",  id_worker);       break;
-            case 2: key = ftok("worker-right", id_worker);       break;
-            case 3: key = ftok("worker-left",  id_collab_right); break;
-            default: ;
+    if (!chunk_free_count) {
+        part->overflow = 1;
+        return NULL;
+    }
+    int s = chunk_free[--chunk_free_count];
+    if (s >= chunk_top) chunk_top = s+1;
+
+    c = &part->chunk[s];
+    memset(c->row, 0, sizeof(c->row));
+    c->cx = cx;
+    c->cy = cy;
+    c->used = 1;
+    c->wanted = 0;
+    worker_sparse_insert(s);
+    return c;
+}
+
+/**
+ * Отправить владельцу чанка заявку на него.
+ * @param[in] cx номер чанка по вертикали
+ * @param[in] cy номер чанка по горизонтали
+ */
+void worker_sparse_request(int cx, int cy) {
+    struct chunk_part *p = chunks_part(chunks, chunk_owner(cx, cy, K));
+    uint32_t k = __atomic_fetch_add(&p->count, 1, __ATOMIC_RELAXED);
+    if (k < CHUNK_INBOX) {
+        p->inbox[k].cx = cx;
+        p->inbox[k].cy = cy;
+    } else p->overflow = 1;
+}
+
+/**
+ * Отправить заявки на соседние чанки, к краям которых подошли живые
+ * клетки чанка: только в таких чанках могут родиться клетки.
+ * @param[in] cx номер чанка по вертикали
+ * @param[in] cy номер чанка по горизонтали
+ * @param[in] row строки чанка
+ */
+void worker_sparse_edges(int cx, int cy, const uint64_t *row) {
+    uint64_t top = row[0], bottom = row[CHUNK_SIZE-1], west = 0, east = 0;
+    for (int i = 0; i < CHUNK_SIZE; i++) {
+        west |= row[i] & 1;
+        east |= row[i] >> (CHUNK_SIZE-1);
+    }
+
+    if (top)    worker_sparse_request(cx-1, cy);
+    if (bottom) worker_sparse_request(cx+1, cy);
+    if (west)   worker_sparse_request(cx, cy-1);
+    if (east)   worker_sparse_request(cx, cy+1);
+    if (top & 1)                     worker_sparse_request(cx-1, cy-1);
+    if (top >> (CHUNK_SIZE-1))       worker_sparse_request(cx-1, cy+1);
+    if (bottom & 1)                  worker_sparse_request(cx+1, cy-1);
+    if (bottom >> (CHUNK_SIZE-1))    worker_sparse_request(cx+1, cy+1);
+}
+
+/**
+ * Сменить буферы чанков рабочего, если новое поколение уже построено.
+ * Вызывается только тогда, когда соседи не читают чанки рабочего.
+ */
+void worker_sparse_settle(void) {
+    if (!chunk_pending) return;
+    part->cur ^= 1;
+    chunk_pending = 0;
+}
+
+/**
+ * Изменить состояние клетки разреженной "вселенной". Для живой клетки
+ * чанк при необходимости занимается, а если клетка лежит на краю чанка,
+ * соседним чанкам отправляются заявки.
+ * @param[in] x номер строки "вселенной"
+ * @param[in] y номер столбца "вселенной"
+ * @param[in] c '*' для живой клетки, '.' для мертвой
+ */
+void worker_sparse_put(int x, int y, char c) {
+    worker_sparse_settle();
+
+    int cx = chunk_index(x-1), cy = chunk_index(y-1);
+    struct chunk *ch = (c == '*') ? worker_sparse_alloc(cx, cy): chunk_find(part, cx, cy);
+    if (!ch) return;
+
+    int i = x-1 - cx*CHUNK_SIZE, j = y-1 - cy*CHUNK_SIZE;
+    kernel_bits_set(&ch->row[part->cur][i], j, c);
+    if (c != '*') return;
+
+    for (int dx = (i == 0) ? -1: 0; dx <= (i == CHUNK_SIZE-1); dx++) {
+        for (int dy = (j == 0) ? -1: 0; dy <= (j == CHUNK_SIZE-1); dy++) {
+            if (dx || dy) worker_sparse_request(cx+dx, cy+dy);
+        }
+    }
+}
+
+/**
+ * Текущие строки чанка любого рабочего.
+ * @param[in] cx номер чанка по вертикали
+ * @param[in] cy номер чанка по горизонтали
+ * @return строки чанка или пустые строки, если чанка нет
+ */
+const uint64_t *worker_sparse_rows(int cx, int cy) {
+    struct chunk_part *p = chunks_part(chunks, chunk_owner(cx, cy, K));
+    struct chunk *c = chunk_find(p, cx, cy);
+    return (c) ? c->row[p->cur]: chunk_zero;
+}
+
+/**
+ * Первый этап поколения: сменить буферы, занять места для чанков по
+ * заявкам из почтового ящика, освободить пустые чанки, на которые заявок
+ * нет, и перестроить хеш-таблицу.
+ */
+void worker_sparse_grow(void) {
+    worker_sparse_settle();
+
+    uint32_t count = part->count;
+    if (count > CHUNK_INBOX) count = CHUNK_INBOX;
+    for (uint32_t k = 0; k < count; k++) {
+        struct chunk *c = worker_sparse_alloc(part->inbox[k].cx, part->inbox[k].cy);
+        if (c) c->wanted = 1;
+    }
+    part->count = 0;
+
+    memset(part->table, 0, sizeof(part->table));
+    for (int s = 0; s < chunk_top; s++) {
+        struct chunk *c = &part->chunk[s];
+        if (!c->used) continue;
+
+        const uint64_t *row = c->row[part->cur];
+        uint64_t live = 0;
+        for (int i = 0; i < CHUNK_SIZE; i++) live |= row[i];
+
+        if (!live && !c->wanted) {
+            c->used = 0;
+            chunk_free[chunk_free_count++] = s;
+            continue;
+        }
+        c->wanted = 0;
+        worker_sparse_insert(s);
+    }
+    worker_is_ready();
+}
+
+/**
+ * Перемешать биты слова (финализатор splitmix64).
+ * @param[in] v слово
+ * @return перемешанное слово
+ */
+uint64_t worker_mix(uint64_t v) {
+    v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+    return v ^ (v >> 31);
+}
+
+/**
+ * Добавить слово к хешу блока.
+ * @param[in] h хеш
+ * @param[in] w слово
+ * @return новый хеш
+ */
+uint64_t worker_hash_word(uint64_t h, uint64_t w) {
+    return (((h << 5) | (h >> 59)) ^ w) * 0x9e3779b97f4a7c15ULL;
+}
+
+/**
+ * Второй этап поколения: построить новое поколение каждого чанка
+ * рабочего в его втором буфере. Чанк вместе с краями соседей
+ * раскладывается в упакованную карту 66 x 66 клеток, которую строит
+ * упакованное ядро. Хеш чанков — сумма хешей непустых строк, смешанных
+ * с их координатами, поэтому он не зависит от порядка чанков и от
+ * пустых чанков.
+ * @param[in] hash 1, если нужно посчитать хеш нового поколения
+ */
+void worker_sparse_step(int hash) {
+    uint64_t t0 = stats_now();
+    uint64_t ext[2][CHUNK_SIZE+2][2];
+    uint64_t *prev[CHUNK_SIZE+2], *curr[CHUNK_SIZE+2];
+    for (int i = 0; i < CHUNK_SIZE+2; i++) {
+        prev[i] = ext[0][i];
+        curr[i] = ext[1][i];
+    }
+    uint64_t h = 0;
+
+    for (int s = 0; s < chunk_top; s++) {
+        struct chunk *c = &part->chunk[s];
+        if (!c->used) continue;
+
+        const uint64_t *nb[3][3];
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++)
+                nb[dx+1][dy+1] = (dx || dy) ? worker_sparse_rows(c->cx+dx, c->cy+dy): c->row[part->cur];
+        }
+
+        for (int i = 0; i < CHUNK_SIZE+2; i++) {
+            int r = (i == 0) ? 0: (i == CHUNK_SIZE+1) ? 2: 1;
+            int k = (i == 0) ? CHUNK_SIZE-1: (i == CHUNK_SIZE+1) ? 0: i-1;
+            uint64_t mid = nb[r][1][k];
+            prev[i][0] = (mid << 1) | (nb[r][0][k] >> (CHUNK_SIZE-1));
+            prev[i][1] = (mid >> (CHUNK_SIZE-1)) | ((nb[r][2][k] & 1) << 1);
         }
+        kernel_bits_step(&rule, prev, curr, 1, CHUNK_SIZE, CHUNK_SIZE);
 
-        semid[i] = semget(key, 1, 0666);
-        shmid[i] = shmget(key, M, 0666);
-        shmad[i] = shmat(shmid[i], NULL, 0);
-        memset(shmad[i], '.', M);
+        uint64_t *next = c->row[1 - part->cur];
+        for (int i = 0; i < CHUNK_SIZE; i++) next[i] = (curr[i+1][0] >> 1) | (curr[i+1][1] << (CHUNK_SIZE-1));
+        worker_sparse_edges(c->cx, c->cy, next);
 
-        sops[i].sem_num = 0;
-        sops[i].sem_flg = 0;
+        if (!hash) continue;
+        uint64_t key = ((uint64_t) (uint32_t) c->cx << 32 | (uint32_t) c->cy) * CHUNK_SIZE;
+        for (int i = 0; i < CHUNK_SIZE; i++) {
+            if (next[i]) h += worker_mix(next[i] ^ worker_mix(key + i));
+        }
     }
+    chunk_pending = 1;
+    if (hash) stats->hash = h;
+
+    uint64_t t1 = stats_now();
+    stats_add(&stats->phase[ST_COMPUTE], t1 - t0);
+    __atomic_store_n(&stats->generations, stats->generations + 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ring->busy, t1 - t0, __ATOMIC_RELAXED);
+    worker_is_ready();
+}
+
+/**
+ * Скопировать живые клетки чанков рабочего, попадающие в окно
+ * "вселенной", в буфер b общего кадра.
+ * @param[in] b номер буфера кадра (0 или 1)
+ */
+void worker_sparse_snap(int b) {
+    worker_sparse_settle();
+
+    for (int s = 0; s < chunk_top; s++) {
+        struct chunk *c = &part->chunk[s];
+        if (!c->used) continue;
 
-    map_state_curr = (char **) calloc(M+2, sizeof(char *));
-    map_state_prev = (char **) calloc(M+2, sizeof(char *));
+        for (int i = 0; i < CHUNK_SIZE; i++) {
+            int x = c->cx*CHUNK_SIZE + i;
+            uint64_t v = c->row[part->cur][i];
+            if (!v || x < 0 || x >= rows_total) continue;
 
-    for (int i = 0; i < M+2; i++) {
-        map_state_curr[i] = (char *) calloc(N+2, sizeof(char));
-        map_state_prev[i] = (char *) calloc(N+2, sizeof(char));
-        for (int j = 0; j < N+2; j++) {
-            map_state_curr[i][j] = '.';
+            for (int j = 0; j < CHUNK_SIZE; j++) {
+                int y = c->cy*CHUNK_SIZE + j;
+                if ((v >> j & 1) && y >= 0 && y < cols_total) fb_row(fb, b, x)[y] = '*';
+            }
         }
     }
+    worker_is_ready();
+}
 
+/**
+ * Подсчитать живые клетки чанков рабочего для команды "stats".
+ */
+void worker_sparse_stats(void) {
+    int64_t live = 0;
+
+    worker_sparse_settle();
+    for (int s = 0; s < chunk_top; s++) {
+        struct chunk *c = &part->chunk[s];
+        if (!c->used) continue;
+        for (int i = 0; i < CHUNK_SIZE; i++) live += __builtin_popcountll(c->row[part->cur][i]);
+    }
+
+    __atomic_store_n(&stats->live, live, __ATOMIC_RELAXED);
     worker_is_ready();
 }
 
+/**
+ * Освободить все чанки рабочего.
+ */
+void worker_sparse_clear(void) {
+    for (int s = 0; s < chunk_top; s++) part->chunk[s].used = 0;
+    for (int s = 0; s < CHUNK_CAPACITY; s++) chunk_free[s] = CHUNK_CAPACITY-1-s;
+    chunk_free_count = CHUNK_CAPACITY;
+    chunk_top = 0;
+    memset(part->table, 0, sizeof(part->table));
+    part->count = 0;
+    part->overflow = 0;
+    chunk_pending = 0;
+    worker_is_ready();
+}
+
+/**
+ * Инициализация рабочего. Рабочий
+ *   -# подключает управляющий сегмент, семафоры и разделяемую память;
+ *   -# динамически выделяет память под массивы, описанные в глобальной
+ * области кода;
+ *   -# очищает таблицу текущего состояния.
+ * Рабочий разреженной "вселенной" вместо карт готовит стек свободных
+ * мест для чанков.
+ */
+void worker_init(void) {
+    uint16_t birth, survive;
+    kernel_rule_parse(KERNEL_RULE_CONWAY, &birth, &survive);
+    kernel_rule_make(birth, survive, &rule);
+
+    rcv_worker_info();
+    if (chunks) {
+        worker_sparse_setup();
+    } else worker_setup();
+    worker_is_ready();
+}
+
+/**
+ * Освободить карты и отключить границы (операция, обратная
+ * worker_setup()).
+ */
+void worker_release(void) {
+    munmap(grid_base, grid_size);
+    if (kernel == KERNEL_BITS) {
+        free(bits_state_curr);
+        free(bits_state_prev);
+    } else {
+        free(map_state_curr);
+        free(map_state_prev);
+    }
+    free(tile_curr);
+    free(tile_prev);
+    free(tile_moved);
+
+    if (net_fd != -1) {
+        for (int s = H_WEST; s <= H_SE; s++) {
+            if (shmad[s] != shmad[halo_border[s-H_WEST]]) free(shmad[s]);
+        }
+        for (int b = B_LEFT; b <= B_BOTTOM; b++) free(shmad[b]);
+        return;
+    }
+#ifndef LIFE_WORKER_THREAD
+    for (int i = 0; i < SEGMENTS; i++) shmdt(shmad[i]);
+#endif
+}
+
 /**
  * Рабочий завершает свою работу:
- *   -# отключает разделяемую память, семафоры и очередь сообщений;
  *   -# освобождение динамической памяти;
- *   -# отправляет уведомление серверу.
+ *   -# отключает разделяемую память и управляющий сегмент.
  */
 void worker_quit(void) {
-    for (int i = 0; i < M+2; i++) {
-        free(map_state_curr[i]);
-        free(map_state_prev[i]);
+    if (chunks) {
+        free(chunk_free);
+    } else worker_release();
+    if (net_fd != -1) {
+        for (int i = 0; i < K; i++) {
+            if (net_link[i] >= 0) close(net_link[i]);
+        }
+        close(net_fd);
+        free(net_link);
+        free(net_cmd.data);
+        free(ctl);
+        return;
+    }
+#ifndef LIFE_WORKER_THREAD
+    shmdt(ctl);
+    shmdt(fb);
+    if (chunks) shmdt(chunks);
+#endif
+}
+
+/**
+ * Изменить состояние клетки блока и, если клетка лежит в одной из
+ * границ, соответствующую разделяемую память.
+ * @param[in] x номер строки блока (1..M)
+ * @param[in] y номер столбца блока (1..N)
+ * @param[in] c '*' для живой клетки, '.' для мертвой
+ */
+void worker_put_cell(int x, int y, char c) {
+    if (chunks) {
+        worker_sparse_put(x, y, c);
+        return;
     }
-    free(map_state_curr);
-    free(map_state_prev);
 
-    for (int i = 0; i < 4; i++) shmdt(shmad[i]);
+    worker_set_cell(G-1+x, G-1+y, c);
+    worker_touch_cell(G-1+x, G-1+y);
+    if (y <= G)   shmad[B_LEFT][(y-1)*M + x-1] = c;
+    if (y > N-G)  shmad[B_RIGHT][(y-1-(N-G))*M + x-1] = c;
+    if (x <= G)   shmad[B_TOP][(x-1)*N + y-1] = c;
+    if (x > M-G)  shmad[B_BOTTOM][(x-1-(M-G))*N + y-1] = c;
+    border_dirty[B_LEFT]   |= y <= G;
+    border_dirty[B_RIGHT]  |= y > N-G;
+    border_dirty[B_TOP]    |= x <= G;
+    border_dirty[B_BOTTOM] |= x > M-G;
+}
+
+/**
+ * Записать одну границу блока в разделяемую память без синхронизации с
+ * соседями.
+ * @param[in] b граница (B_LEFT..B_BOTTOM)
+ */
+void worker_write_border(int b) {
+    border_dirty[b] = 1;
+    for (int k = 0; k < G; k++) {
+        if (b == B_LEFT || b == B_RIGHT) {
+            int y = (b == B_LEFT) ? G+k: N+k;
+            for (int i = 0; i < M; i++) shmad[b][k*M + i] = worker_get_cell(G+i, y);
+        } else {
+            int x = (b == B_TOP) ? G+k: M+k;
+            for (int j = 0; j < N; j++) shmad[b][k*N + j] = worker_get_cell(x, G+j);
+        }
+    }
+}
+
+/**
+ * Записать границы блока в разделяемую память без синхронизации с
+ * соседями (соседи в этот момент границы не читают).
+ */
+void worker_write_borders(void) {
+    for (int b = B_LEFT; b <= B_BOTTOM; b++) worker_write_border(b);
 }
 
 /**
@@ -200,9 +993,7 @@ void worker_quit(void) {
  * @param[in] y номер столбца
  */
 void worker_add(int x, int y) {
-    map_state_curr[x][y] = '*';
-    if (y == 1) shmad[1][x-1] = '*';
-    if (y == N) shmad[2][x-1] = '*';
+    worker_put_cell(x, y, '*');
     worker_is_ready();
 }
 
@@ -212,52 +1003,188 @@ void worker_add(int x, int y) {
  * @param[in] y номер столбца
  */
 void worker_del(int x, int y) {
-    map_state_curr[x][y] = '.';
-    if (y == 1) shmad[1][x-1] = '.';
-    if (y == N) shmad[2][x-1] = '.';
+    worker_put_cell(x, y, '.');
     worker_is_ready();
 }
 
 /**
- * Рабочий освобождает свою область "вселенной".
+ * Отобразить в память файл контрольной точки, путь к которому сервер
+ * записал в управляющий сегмент.
+ * @param[in] write 1 — для записи, 0 — только для чтения
+ * @param[out] size размер отображения
+ * @return начало отображения или MAP_FAILED
  */
-void worker_clear(void) {
-    for (int i = 0; i < M+2; i++) {
-        for (int j = 0; j < N+2; j++) {
-            map_state_curr[i][j] = '.';
+void *worker_map_checkpoint(int write, size_t *size) {
+    struct stat st;
+    int fd = open(ctl->path, (write) ? O_RDWR: O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) close(fd);
+        return MAP_FAILED;
+    }
+    *size = st.st_size;
+    void *base = mmap(NULL, *size, (write) ? PROT_READ | PROT_WRITE: PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return base;
+}
+
+/**
+ * Сохранить блок в контрольную точку: каждая строка блока упаковывается
+ * и добавляется в строку файла со смещением блока. Рабочие пишут в файл
+ * параллельно.
+ */
+void worker_save(void) {
+    size_t size;
+    void *base = worker_map_checkpoint(1, &size);
+    if (base == MAP_FAILED) {
+        worker_is_ready();
+        return;
+    }
+
+    int x0 = row_first;
+    int y0 = col_first;
+    int words = kernel_bits_words(N+2*G);
+    uint64_t *packed = (uint64_t *) calloc(words, sizeof(uint64_t));
+
+    for (int i = 0; i < M; i++) {
+        const uint64_t *src = packed;
+        if (kernel == KERNEL_BITS) {
+            src = bits_state_curr[G+i];
+        } else kernel_pack_row(map_state_curr[G+i], packed, N+2*G);
+
+        uint64_t *dst = ckpt_row(base, x0+i);
+        for (int k = 0; k < N; k += 64) {
+            uint64_t v = ckpt_get_bits(src, words, G+k);
+            if (N-k < 64) v &= ((uint64_t) 1 << (N-k)) - 1;
+            ckpt_or_bits(dst, y0+k, v);
         }
     }
 
-    for (int i = 0; i < M; i++)
-        shmad[1][i] = (shmad[2][i] = '.');
+    free(packed);
+    munmap(base, size);
+    worker_is_ready();
+}
+
+/**
+ * Восстановить блок из контрольной точки и обновить границы.
+ */
+void worker_restore(void) {
+    size_t size;
+    void *base = worker_map_checkpoint(0, &size);
+    if (base == MAP_FAILED) {
+        worker_is_ready();
+        return;
+    }
+
+    int x0 = row_first;
+    int y0 = col_first;
+    int words = ckpt_words(cols_total);
 
+    for (int i = 0; i < M; i++) {
+        const uint64_t *src = ckpt_row(base, x0+i);
+        if (kernel == KERNEL_BITS) {
+            uint64_t *dst = bits_state_curr[G+i];
+            memset(dst, 0, kernel_bits_words(N+2*G) * sizeof(uint64_t));
+            for (int k = 0; k < N; k += 64) {
+                uint64_t v = ckpt_get_bits(src, words, y0+k);
+                if (N-k < 64) v &= ((uint64_t) 1 << (N-k)) - 1;
+                ckpt_or_bits(dst, G+k, v);
+            }
+        } else kernel_unpack_row(src, &map_state_curr[G+i][G], y0, N);
+    }
+
+    munmap(base, size);
+    worker_touch_tiles(1);
+    worker_write_borders();
     worker_is_ready();
 }
 
 /**
- * Посчитать количество соседей у данной клетки.
- * @param[in] x номер строки
- * @param[in] y номер столбца
- * @return число соседей
- */
-int worker_count_neigbours(int x, int y) {
-    int number = 0;
-    for (int i = x-1; i <= x+1; i++) {
-        for (int j = y-1; j <= y+1; j++) {
-            if (!(i == x && j == y) && map_state_prev[i][j] == '*')
-                number++;
+ * Добавить в блок пачку клеток образца, подготовленную сервером. При
+ * сетевом транспорте пары (строка, столбец) лежат в содержимом команды.
+ * @param[in] id идентификатор сегмента с клетками (см. O_LOAD)
+ */
+void worker_load(int id) {
+    if (net_fd != -1) {
+        int *cell = (int *) net_cmd.data;
+        for (uint32_t i = 0; i < net_cmd.hdr.len / (2 * sizeof(int)); i++)
+            worker_put_cell(cell[2*i], cell[2*i+1], '*');
+        worker_is_ready();
+        return;
+    }
+
+    int *payload = shmat(id, NULL, SHM_RDONLY);
+    int *cell = payload + 2*K + 2*payload[id_worker];
+
+    for (int i = 0; i < payload[K + id_worker]; i++)
+        worker_put_cell(cell[2*i], cell[2*i+1], '*');
+
+    shmdt(payload);
+    worker_is_ready();
+}
+
+/**
+ * Рабочий освобождает свою область "вселенной".
+ */
+void worker_clear(void) {
+    if (chunks) {
+        worker_sparse_clear();
+        return;
+    }
+
+    if (kernel == KERNEL_BITS) {
+        int words = kernel_bits_words(N+2*G);
+        for (int i = 0; i < M+2*G; i++)
+            memset(bits_state_curr[i], 0, words * sizeof(uint64_t));
+    } else {
+        for (int i = 0; i < M+2*G; i++) {
+            for (int j = 0; j < N+2*G; j++) {
+                map_state_curr[i][j] = '.';
+            }
         }
     }
-    return number;
+
+    memset(shmad[B_LEFT],   '.', G*M);
+    memset(shmad[B_RIGHT],  '.', G*M);
+    memset(shmad[B_TOP],    '.', G*N);
+    memset(shmad[B_BOTTOM], '.', G*N);
+    memset(border_dirty, 1, sizeof(border_dirty));
+
+    worker_touch_tiles(1);
+    worker_is_ready();
 }
 
 /**
  * Опустить семафор.
  * @param[in] i номер семафора
+ * @param[in] n на сколько опустить семафор
  */
-void sem_down(int i) {
-    sops[i].sem_op = -1;
+void sem_down(int i, int n) {
+    if (net_fd != -1) return;
+#ifdef LIFE_WORKER_THREAD
+    fsem_down(fsem[i], n);
+#else
+    sops[i].sem_op = -n;
     semop(semid[i], (struct sembuf *) &sops[i], 1);
+#endif
+}
+
+/**
+ * Опустить семафор, если это можно сделать без ожидания.
+ * @param[in] i номер семафора
+ * @param[in] n на сколько опустить семафор
+ * @return 1, если семафор опущен, иначе 0
+ */
+int sem_trydown(int i, int n) {
+    if (net_fd != -1) return 1;
+#ifdef LIFE_WORKER_THREAD
+    return fsem_trydown(fsem[i], n);
+#else
+    sops[i].sem_op  = -n;
+    sops[i].sem_flg = IPC_NOWAIT;
+    int rc = semop(semid[i], (struct sembuf *) &sops[i], 1);
+    sops[i].sem_flg = 0;
+    return rc != -1;
+#endif
 }
 
 /**
@@ -265,105 +1192,620 @@ void sem_down(int i) {
  * @param[in] i номер семафора
  */
 void sem_up(int i) {
+    if (net_fd != -1) return;
+#ifdef LIFE_WORKER_THREAD
+    fsem_up(fsem[i]);
+#else
     sops[i].sem_op = 1;
     semop(semid[i], (struct sembuf *) &sops[i], 1);
+#endif
+}
+
+/**
+ * Принять границу соседа, пришедшую по сетевому транспорту, в сегмент
+ * ореола, номер которого указан в op кадра.
+ * @param[in] msg кадр
+ * @param[in] arg не используется
+ */
+void worker_net_deliver(const struct net_msg *msg, void *arg) {
+    int s = msg->hdr.op;
+    if (!msg->hdr.prm1 || s < H_WEST || s > H_SE) return;
+
+    char *buf = (char *) realloc(shmad[s], msg->hdr.len);
+    if (!buf) return;
+    memcpy(buf, msg->data, msg->hdr.len);
+    shmad[s] = buf;
 }
 
 /**
- * Обновить карту последнего сгенерированного поколения.
+ * Обменяться границами с соседями по сетевому транспорту. Каждая
+ * граница отправляется всем ее читателям (сегмент ореола читателя
+ * указывается в op кадра), а изменившиеся после прошлого обмена границы
+ * отправляются с содержимым. Обмен выполняется в начале пакета, поэтому
+ * соседи получают и клетки, измененные командами между пакетами.
+ */
+void worker_net_exchange(void) {
+    struct net_out out[8];
+    struct net_in in[8];
+    int nout = 0, nin = 0;
+
+    for (int s = 0; s < 8; s++) {
+        int b = halo_border[s];
+        int reader = worker_partner(-halo_dr[s], -halo_dc[s]);
+        if (reader != id_worker) {
+            out[nout].fd   = net_link[reader];
+            out[nout].op   = H_WEST + s;
+            out[nout].prm1 = border_dirty[b];
+            out[nout].data = shmad[b];
+            out[nout].len  = (border_dirty[b]) ? G * ((b == B_LEFT || b == B_RIGHT) ? M: N): 0;
+            nout++;
+        }
+
+        int source = worker_partner(halo_dr[s], halo_dc[s]);
+        if (source == id_worker) continue;
+        int k = 0;
+        while (k < nin && in[k].fd != net_link[source]) k++;
+        if (k == nin) {
+            memset(&in[nin++], 0, sizeof(struct net_in));
+            in[k].fd = net_link[source];
+        }
+        in[k].expect++;
+    }
+
+    if (net_exchange(out, nout, in, nin, worker_net_deliver, NULL) == -1)
+        quit_message("ERROR: Lost connection to a neighbour.");
+    for (int k = 0; k < nin; k++) free(in[k].msg.data);
+    memset(border_dirty, 0, sizeof(border_dirty));
+}
+
+/**
+ * Записать ореол из разделяемой памяти соседей в текущую карту и
+ * сообщить соседям, что их границы прочитаны. Плитки, в которых ореол
+ * изменился, помечаются (см. worker_set_halo()).
+ *
+ * Угловые области ореола берутся из крайних G столбцов верхней или
+ * нижней границы диагонального соседа.
+ */
+void worker_read_halo(void) {
+    int ww = width_collab[0], we = width_collab[1];
+
+    for (int k = 0; k < G; k++) {
+        for (int i = 0; i < M; i++) {
+            worker_set_halo(G+i, k,     shmad[H_WEST][k*M + i]);
+            worker_set_halo(G+i, G+N+k, shmad[H_EAST][k*M + i]);
+        }
+        for (int j = 0; j < N; j++) {
+            worker_set_halo(k,     G+j, shmad[H_NORTH][k*N + j]);
+            worker_set_halo(G+M+k, G+j, shmad[H_SOUTH][k*N + j]);
+        }
+        for (int q = 0; q < G; q++) {
+            worker_set_halo(k,     q,     shmad[H_NW][k*ww + ww-G+q]);
+            worker_set_halo(k,     G+N+q, shmad[H_NE][k*we + q]);
+            worker_set_halo(G+M+k, q,     shmad[H_SW][k*ww + ww-G+q]);
+            worker_set_halo(G+M+k, G+N+q, shmad[H_SE][k*we + q]);
+        }
+    }
+
+    for (int s = H_WEST; s <= H_SE; s++) sem_up(s);
+}
+
+/**
+ * Обновить карту последнего сгенерированного поколения: карты меняются
+ * местами без копирования. Ядра записывают каждую клетку вычисляемой
+ * области, а область с каждым поколением пакета сужается, поэтому
+ * устаревшие строки и столбцы новой текущей карты не читаются. Ореол
+ * записывается в текущую карту до первой смены (см. worker_start()).
+ * Вместе с картами меняются местами признаки плиток; признаки новой
+ * текущей карты заполняются по мере построения поколения.
  */
 void worker_update_map(void) {
-    for (int i = 0; i < M+2; i++)
-        memcpy(map_state_prev[i], map_state_curr[i], N+2);
+    char *t = tile_prev;
+    tile_prev = tile_curr;
+    tile_curr = t;
+    worker_touch_tiles(0);
+
+    if (kernel == KERNEL_BITS) {
+        uint64_t **tmp = bits_state_prev;
+        bits_state_prev = bits_state_curr;
+        bits_state_curr = tmp;
+    } else {
+        char **tmp = map_state_prev;
+        map_state_prev = map_state_curr;
+        map_state_curr = tmp;
+    }
+}
+
+/**
+ * Проверить, изменилась ли граница за пакет: граница изменилась, если
+ * изменилась хотя бы одна пересекающая ее плитка.
+ * @param[in] b граница (B_LEFT..B_BOTTOM)
+ * @return 1, если границу нужно переписать, иначе 0
+ */
+int worker_border_moved(int b) {
+    int x0 = G, x1 = M+G-1, y0 = G, y1 = N+G-1;
+    switch (b) {
+        case B_LEFT:   y1 = 2*G-1; break;
+        case B_RIGHT:  y0 = N;     break;
+        case B_TOP:    x1 = 2*G-1; break;
+        case B_BOTTOM: x0 = M;     break;
+    }
+
+    for (int r = x0 / WORKER_TILE; r <= x1 / WORKER_TILE; r++) {
+        for (int c = y0 / tile_width; c <= y1 / tile_width; c++) {
+            if (tile_moved[r*tile_cols + c]) return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Опубликовать границу, если соседи уже прочитали ее предыдущее
+ * значение, не дожидаясь их.
+ * @param[in] b граница (B_LEFT..B_BOTTOM)
+ * @param[in,out] done признаки опубликованных границ
+ * @param[in,out] border время записи границ, нс
+ */
+void worker_try_publish(int b, char *done, uint64_t *border) {
+    if (done[b] || !sem_trydown(b, worker_readers(b))) return;
+
+    uint64_t t0 = stats_now();
+    if (worker_border_moved(b)) worker_write_border(b);
+    *border += stats_now() - t0;
+    done[b] = 1;
+}
+
+/**
+ * Обновить разделяемую память, соотвествующую границам рабочего: еще не
+ * опубликованные границы записываются после того, как соседи прочитают
+ * их предыдущее значение. Границы, не изменившиеся за пакет, не
+ * переписываются, но соседям по-прежнему нужно дождаться их прочтения.
+ * Ожидание соседей и запись границ учитываются в счетчиках этапов.
+ * @param[in] done признаки уже опубликованных границ
+ * @param[in] border время записи уже опубликованных границ, нс
+ */
+void worker_update_memory(const char *done, uint64_t border) {
+    uint64_t sync = 0;
+
+    for (int b = B_LEFT; b <= B_BOTTOM; b++) {
+        if (done[b]) continue;
+
+        uint64_t t0 = stats_now();
+        sem_down(b, worker_readers(b));
+        uint64_t t1 = stats_now();
+        if (worker_border_moved(b)) worker_write_border(b);
+        sync   += t1 - t0;
+        border += stats_now() - t1;
+    }
+
+    stats_add(&stats->phase[ST_SYNC], sync);
+    stats_add(&stats->phase[ST_BORDER], border);
+}
+
+/**
+ * Проверить, нужно ли строить плитку: плитка строится, если в последнем
+ * смоделированном поколении изменилась она сама или одна из соседних
+ * плиток.
+ * @param[in] r ряд плитки
+ * @param[in] c колонка плитки
+ * @return 1, если плитку нужно строить, иначе 0
+ */
+int worker_tile_active(int r, int c) {
+    for (int i = (r > 0) ? r-1: 0; i <= r+1 && i < tile_rows; i++) {
+        for (int j = (c > 0) ? c-1: 0; j <= c+1 && j < tile_cols; j++) {
+            if (tile_prev[i*tile_cols + j]) return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Сравнить построенный прямоугольник текущей карты с последней
+ * смоделированной картой. Упакованные строки сравниваются целиком, кроме
+ * клеток 0 и N+2G-1, которые ядро не вычисляет.
+ * @param[in] x0 первая строка
+ * @param[in] x1 последняя строка
+ * @param[in] y0 первый столбец
+ * @param[in] y1 последний столбец
+ * @return 1, если прямоугольник изменился, иначе 0
+ */
+int worker_tile_changed(int x0, int x1, int y0, int y1) {
+    if (kernel != KERNEL_BITS) {
+        for (int i = x0; i <= x1; i++) {
+            if (memcmp(&map_state_curr[i][y0], &map_state_prev[i][y0], y1-y0+1)) return 1;
+        }
+        return 0;
+    }
+
+    int last = N+2*G-1, words = last / KERNEL_WORD_BITS + 1;
+    uint64_t tail = ((uint64_t) 1 << (last % KERNEL_WORD_BITS)) - 1;
+    for (int i = x0; i <= x1; i++) {
+        const uint64_t *a = bits_state_curr[i], *b = bits_state_prev[i];
+        for (int w = 0; w < words; w++) {
+            uint64_t diff = a[w] ^ b[w];
+            if (w == 0) diff &= ~(uint64_t) 1;
+            if (w == words-1) diff &= tail;
+            if (diff) return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Построить очередное поколение в прямоугольнике карты. Прямоугольник
+ * строится по плиткам: плитки, которые не нужно строить (см.
+ * worker_tile_active()), пропускаются, построенные сравниваются с
+ * последним смоделированным поколением, и изменившиеся помечаются.
+ * Упакованное ядро строит строки целиком, поэтому столбцы для него не
+ * учитываются.
+ * @param[in] x0 первая вычисляемая строка
+ * @param[in] x1 последняя вычисляемая строка
+ * @param[in] y0 первый вычисляемый столбец
+ * @param[in] y1 последний вычисляемый столбец
+ */
+void worker_step(int x0, int x1, int y0, int y1) {
+    if (x0 > x1 || y0 > y1) return;
+
+    for (int r = x0 / WORKER_TILE; r <= x1 / WORKER_TILE; r++) {
+        for (int c = y0 / tile_width; c <= y1 / tile_width; c++) {
+            if (!worker_tile_active(r, c)) continue;
+
+            int a0 = (x0 > r*WORKER_TILE) ? x0: r*WORKER_TILE;
+            int a1 = (x1 < (r+1)*WORKER_TILE-1) ? x1: (r+1)*WORKER_TILE-1;
+            int b0 = (y0 > c*tile_width) ? y0: c*tile_width;
+            int b1 = (y1 < (c+1)*tile_width-1) ? y1: (c+1)*tile_width-1;
+
+            if (kernel == KERNEL_BITS) {
+                kernel_bits_step(&rule, bits_state_prev, bits_state_curr, a0, a1, N+2*G-2);
+            } else kernel_byte_step(kernel, &rule, map_state_prev, map_state_curr, a0, a1, b0, b1);
+
+            if (worker_tile_changed(a0, a1, b0, b1)) {
+                tile_curr[r*tile_cols + c]  = 1;
+                tile_moved[r*tile_cols + c] = 1;
+            }
+        }
+    }
+}
+
+/**
+ * Построить последнее поколение пакета, начиная с рамки блока. Сначала
+ * строятся строки и столбцы, которые попадают в границы (G строк или
+ * столбцов у каждого края блока), и те из границ, которые соседи уже
+ * прочитали, сразу публикуются. Затем строится внутренняя часть блока,
+ * и ожидание остальных соседей перекрывается вычислениями. Упакованное
+ * ядро строит строки целиком, поэтому до внутренней части оно успевает
+ * опубликовать только верхнюю и нижнюю границы.
+ * @param[in] t номер поколения в пакете
+ * @param[out] done признаки опубликованных границ
+ * @param[out] border время записи опубликованных границ, нс
+ */
+void worker_last_step(int t, char *done, uint64_t *border) {
+    int x1 = M+2*G-1-t, y1 = N+2*G-1-t;
+
+    if (M < 2*G || N < 2*G) {
+        worker_step(t, x1, t, y1);
+        return;
+    }
+
+    worker_step(t, 2*G-1, t, y1);
+    worker_step(M, x1, t, y1);
+    worker_try_publish(B_TOP, done, border);
+    worker_try_publish(B_BOTTOM, done, border);
+
+    if (kernel == KERNEL_BITS) {
+        worker_step(2*G, M-1, t, y1);
+        return;
+    }
+
+    worker_step(2*G, M-1, t, 2*G-1);
+    worker_step(2*G, M-1, N, y1);
+    worker_try_publish(B_LEFT, done, border);
+    worker_try_publish(B_RIGHT, done, border);
+
+    worker_step(2*G, M-1, 2*G, N-1);
+}
+
+/**
+ * Посчитать хеш блока (без ореола) для поиска циклов сервером.
+ * @return хеш блока
+ */
+uint64_t worker_hash(void) {
+    uint64_t h = 0;
 
     for (int i = 0; i < M; i++) {
-        map_state_prev[i+1][0]   = shmad[0][i];
-        map_state_prev[i+1][N+1] = shmad[3][i];
+        if (kernel == KERNEL_BITS) {
+            int words = kernel_bits_words(N+2*G);
+            for (int k = 0; k < N; k += 64) {
+                uint64_t v = ckpt_get_bits(bits_state_curr[G+i], words, G+k);
+                if (N-k < 64) v &= ((uint64_t) 1 << (N-k)) - 1;
+                h = worker_hash_word(h, v);
+            }
+        } else {
+            const char *row = &map_state_curr[G+i][G];
+            int j = 0;
+            for (; j + 8 <= N; j += 8) {
+                uint64_t v;
+                memcpy(&v, row + j, 8);
+                h = worker_hash_word(h, v);
+            }
+            for (; j < N; j++) h = worker_hash_word(h, (uint8_t) row[j]);
+        }
+    }
+    return worker_mix(h);
+}
+
+/**
+ * Построить несколько очередных поколений без обмена границами.
+ *
+ * После t-го поколения достоверны только строки t..M+2G-1-t и столбцы
+ * t..N+2G-1-t, поэтому число поколений в пакете не должно превышать
+ * глубину ореола G. Ореол к началу пакета всегда готов: соседи записали
+ * границы до подтверждения предыдущей команды. Ждать приходится только
+ * перед записью собственных границ, пока соседи не прочитают их прошлое
+ * значение, поэтому последнее поколение строится рамкой вперед (см.
+ * worker_last_step()). Время построения (без ожидания соседей)
+ * добавляется к счетчику busy кольца рабочего, по нему сервер
+ * балансирует нагрузку; время чтения ореола, смены карт и
+ * вычислений — к счетчикам этапов. Если сервер ищет циклы, после пакета
+ * считается хеш блока (см. worker_hash()); при сетевом транспорте он
+ * отправляется серверу в подтверждении.
+ * @param[in] gens число поколений (1..G)
+ * @param[in] hash 1, если нужен хеш блока
+ */
+void worker_start(int gens, int hash) {
+    if (chunks) {
+        worker_sparse_step(hash);
+        return;
     }
 
-    sem_up(0);
-    sem_up(3);
-
-    memcpy(map_state_prev[0],   map_state_prev[M], N+2);
-    memcpy(map_state_prev[M+1], map_state_prev[1], N+2);
+    uint64_t t0 = stats_now(), swap = 0, compute = 0, border = 0;
+    char done[4] = {0, 0, 0, 0};
+
+    memset(tile_moved, 0, tile_rows * tile_cols);
+    if (net_fd != -1) worker_net_exchange();
+    worker_read_halo();
+    uint64_t t1 = stats_now();
+    stats_add(&stats->phase[ST_HALO], t1 - t0);
+
+    for (int t = 1; t <= gens; t++) {
+        worker_update_map();
+        uint64_t t2 = stats_now();
+        swap += t2 - t1;
+
+        if (t < gens) {
+            worker_step(t, M+2*G-1-t, t, N+2*G-1-t);
+        } else worker_last_step(t, done, &border);
+        t1 = stats_now();
+        compute += t1 - t2;
+    }
+
+    compute -= border;
+    stats_add(&stats->phase[ST_SWAP], swap);
+    stats_add(&stats->phase[ST_COMPUTE], compute);
+    __atomic_store_n(&stats->generations, stats->generations + gens, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ring->busy, t1 - t0 - border, __ATOMIC_RELAXED);
+
+    worker_update_memory(done, border);
+    if (hash) {
+        stats->hash = worker_hash();
+        worker_reply(&stats->hash, sizeof(stats->hash));
+    } else worker_is_ready();
 }
 
 /**
- * Обновить разделяемую память, соотвествующую границам рабочего.
+ * Строка блока в буфере b общего кадра. При сетевом транспорте кадра у
+ * рабочего нет, и блок (M строк по N клеток подряд) лежит в содержимом
+ * команды.
+ * @param[in] b номер буфера кадра (0 или 1)
+ * @param[in] i номер строки блока, начиная с 0
+ * @return указатель на первую клетку строки блока
  */
-void worker_update_memory(void) {
-    sem_down(1);
-    sem_down(2);
+char *worker_frame_row(int b, int i) {
+    if (net_fd != -1) return net_cmd.data + (size_t) i * N;
+    return fb_row(fb, b, row_first+i) + col_first;
+}
+
+/**
+ * Сделать скриншот: блок рабочего целиком копируется в буфер b общего
+ * кадра "вселенной" (при сетевом транспорте — отправляется серверу в
+ * подтверждении).
+ * @param[in] b номер буфера кадра (0 или 1)
+ */
+void worker_snap(int b) {
+    if (chunks) {
+        worker_sparse_snap(b);
+        return;
+    }
+
+    if (net_fd != -1 && net_cmd.cap < (uint32_t) M * N) {
+        net_cmd.data = (char *) realloc(net_cmd.data, (size_t) M * N);
+        net_cmd.cap  = M * N;
+    }
 
     for (int i = 0; i < M; i++) {
-        shmad[1][i] = map_state_curr[i+1][1];
-        shmad[2][i] = map_state_curr[i+1][N];
+        char *dst = worker_frame_row(b, i);
+        if (kernel == KERNEL_BITS) {
+            kernel_unpack_row(bits_state_curr[G+i], dst, G, N);
+        } else memcpy(dst, &map_state_curr[G+i][G], N);
     }
+    worker_reply(net_cmd.data, (uint32_t) M * N);
 }
 
 /**
- * Построить очередное поколение.
+ * Записать изменения полосы строк id_worker между буфером b общего кадра
+ * и передним буфером (последним скриншотом клиента) отрезками
+ * изменившихся клеток (см. fb_delta_rows()).
+ * @param[in] b номер буфера кадра (0 или 1)
  */
-void worker_start(void) {
-    worker_update_map();
+void worker_delta(int b) {
+    fb_delta_rows(fb, b, life_split(rows_total, K, id_worker),
+                  life_split(rows_total, K, id_worker + 1), fb_delta(fb, id_worker));
+    worker_is_ready();
+}
 
-    for (int i = 1; i <= M; i++){
-        for (int j = 1; j <= N; j++) {
-            int number = worker_count_neigbours(i, j);
+/**
+ * Сменить правило, по которому строятся поколения.
+ * @param[in] birth маска рождения (бит n — n соседей)
+ * @param[in] survive маска выживания
+ */
+void worker_rule(int birth, int survive) {
+    kernel_rule_make(birth, survive, &rule);
+    if (!chunks) worker_touch_tiles(1);
+    worker_is_ready();
+}
 
-            if (map_state_prev[i][j] == '.') {
-                if (number == 3) map_state_curr[i][j] = '*';
-            } else {
-                if (!(number == 2 || number == 3))
-                    map_state_curr[i][j] = '.';
+/**
+ * Подсчитать живые клетки блока для команды "stats".
+ */
+void worker_stats(void) {
+    if (chunks) {
+        worker_sparse_stats();
+        return;
+    }
+
+    int64_t live = 0;
+
+    for (int i = 0; i < M; i++) {
+        if (kernel == KERNEL_BITS) {
+            int words = kernel_bits_words(N+2*G);
+            for (int k = 0; k < N; k += 64) {
+                uint64_t v = ckpt_get_bits(bits_state_curr[G+i], words, G+k);
+                if (N-k < 64) v &= ((uint64_t) 1 << (N-k)) - 1;
+                live += __builtin_popcountll(v);
             }
+        } else {
+            for (int j = G; j < N+G; j++) live += map_state_curr[G+i][j] == '*';
         }
     }
 
-    worker_update_memory();
+    __atomic_store_n(&stats->live, live, __ATOMIC_RELAXED);
+    worker_reply(stats, sizeof(struct life_stats));
+}
+
+/**
+ * Первый шаг перебалансировки: блок уже скопирован в кадр командой
+ * O_SNAP, рабочий освобождает карты и отключает границы, чтобы сервер
+ * мог пересоздать их под новые размеры.
+ */
+void worker_detach(void) {
+    worker_release();
     worker_is_ready();
 }
 
 /**
- * Сделать скриншот строки
- * @param[in] i номер строки
+ * Заполнить блок из буфера кадра b и обновить границы.
+ * @param[in] b номер буфера кадра
  */
-int worker_snap(int i) {
-    message.mtype = pid_server;
-    message.op    = O_SNAP;
-    message.prm1  = id_worker;
-    message.prm2  = N;
-    memcpy(message.mtext, &map_state_curr[i][1], N);
-    message.mtext[N] = '\0';
-    return snd_server_message();
+void worker_read_frame(int b) {
+    for (int i = 0; i < M; i++) {
+        const char *src = worker_frame_row(b, i);
+        for (int j = 0; j < N; j++) worker_set_cell(G+i, G+j, src[j]);
+    }
+    worker_write_borders();
 }
 
 /**
- * Основная функция рабочего. Сервер
- *   -# получает количество процессов-рабочих;
- *   -# осуществляет обмен данных с сервером.
+ * Второй шаг перебалансировки: рабочий пересчитывает размеры блока по
+ * новым границам, подключает новые границы и заполняет блок из буфера
+ * кадра b.
+ * @param[in] b номер буфера кадра, в котором собрана "вселенная"
  */
-int main(int argc, char *argv[]) {
-    sscanf(argv[1], "%d", &K);
-    worker_init();
+void worker_reattach(int b) {
+    worker_geometry();
+    worker_setup();
+    worker_read_frame(b);
+    worker_is_ready();
+}
+
+/**
+ * Заполнить блок из буфера кадра b, в который сервер записал поколение,
+ * построенное HashLife.
+ * @param[in] b номер буфера кадра
+ */
+void worker_fill(int b) {
+    worker_read_frame(b);
+    worker_touch_tiles(1);
+    worker_is_ready();
+}
 
+/**
+ * Цикл рабочего: выполнять команды сервера до команды O_QUIT.
+ */
+void worker_run(void) {
     while (1) {
-		rcv_server_message(0);
+        rcv_server_command();
 
-        if (message.op == O_QUIT) {
+        if (command.op == O_QUIT) {
             break;
         }
 
-        switch (message.op) {
-            case O_ADD:   worker_add(message.prm1, message.prm2); break;
-            case O_DEL:   worker_del(message.prm1, message.prm2); break;
+        switch (command.op) {
+            case O_ADD:   worker_add(command.prm1, command.prm2); break;
+            case O_DEL:   worker_del(command.prm1, command.prm2); break;
+            case O_LOAD:  worker_load(command.prm1); break;
+            case O_SAVE:  worker_save(); break;
+            case O_RESTORE: worker_restore(); break;
             case O_CLEAR: worker_clear(); break;
-            case O_START: worker_start(); break;
-            case O_SNAP:  worker_snap(message.prm1); break;
+            case O_START: worker_start(command.prm1, command.prm2); break;
+            case O_SNAP:  worker_snap(command.prm1); break;
+            case O_DELTA: worker_delta(command.prm1); break;
+            case O_DETACH: worker_detach(); break;
+            case O_ATTACH: worker_reattach(command.prm1); break;
+            case O_STATS: worker_stats(); break;
+            case O_GROW:  worker_sparse_grow(); break;
+            case O_RULE:  worker_rule(command.prm1, command.prm2); break;
+            case O_FILL:  worker_fill(command.prm1); break;
             default: ;
         }
-	}
+    }
+}
+
+#ifdef LIFE_WORKER_THREAD
+void *worker_thread(void *arg) {
+    thread_arg = (struct worker_arg *) arg;
+    id_worker  = thread_arg->id;
+    K          = thread_arg->workers;
+    Px         = thread_arg->cols_blocks;
+    G          = thread_arg->depth;
+    kernel     = thread_arg->kernel;
+    Py = K / Px;
+
+    worker_init();
+    worker_run();
+    worker_quit();
+    return NULL;
+}
+#else
+/**
+ * Основная функция рабочего. Сервер
+ *   -# получает количество процессов-рабочих, свой номер (ключ "-i"),
+ * вычислительное ядро (ключ "-k", по умолчанию — лучшее байтовое ядро по
+ * CPUID), глубину ореола (ключ "-g"), число колонок блоков (ключ "-p"),
+ * способ хранения "вселенной" (ключ "-e": "grid" или "sparse") и адрес
+ * сервера для сетевого транспорта (ключ "-n узел:порт");
+ *   -# осуществляет обмен данных с сервером.
+ */
+int main(int argc, char *argv[]) {
+    sscanf(argv[1], "%d", &K);
+    kernel = kernel_detect();
+    for (int i = 2; i+1 < argc; i += 2) {
+        if (strcmp(argv[i], "-k") == 0 && kernel_by_name(argv[i+1]) != -1)
+            kernel = kernel_by_name(argv[i+1]);
+        if (strcmp(argv[i], "-g") == 0 && atoi(argv[i+1]) > 0)
+            G = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-p") == 0 && atoi(argv[i+1]) > 0)
+            Px = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-i") == 0)
+            id_worker = atoi(argv[i+1]);
+        if (strcmp(argv[i], "-e") == 0)
+            sparse = strcmp(argv[i+1], "sparse") == 0;
+        if (strcmp(argv[i], "-n") == 0)
+            net_server = argv[i+1];
+    }
+    Py = K / Px;
 
+    worker_init();
+    worker_run();
     worker_quit();
     return 0;
 }
+#endif
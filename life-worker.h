@@ -0,0 +1,53 @@
+/**
+ * @file life-worker.h
+ *
+ * Запуск рабочего как потока внутри сервера. Файл life-worker.c,
+ * собранный с ключом LIFE_WORKER_THREAD, дает функцию worker_thread(),
+ * в которой выполняется тот же цикл рабочего, что и в процессе
+ * "life-worker", но все глобальные переменные рабочего принадлежат
+ * потоку, границы лежат в обычной памяти сервера, а вместо семафоров
+ * SysV используются семафоры на futex.
+ */
+
+#ifndef LIFE_WORKER_H
+#define LIFE_WORKER_H
+
+#include "life-ring.h"
+#include "life-fb.h"
+#include "life-chunk.h"
+
+/** @brief параметры рабочего-потока */
+struct worker_arg {
+    /** @brief индекс рабочего */
+    int id;
+    /** @brief число рабочих */
+    int workers;
+    /** @brief число колонок блоков */
+    int cols_blocks;
+    /** @brief глубина ореола */
+    int depth;
+    /** @brief вычислительное ядро (KERNEL_SCALAR, KERNEL_BITS, ...) */
+    int kernel;
+    /** @brief управляющий сегмент */
+    struct life_ctl *ctl;
+    /** @brief кадр для скриншотов */
+    struct life_fb *fb;
+    /** @brief сегмент чанков разреженной "вселенной" или NULL */
+    struct life_chunks *chunks;
+    /** @brief границы всех рабочих: 4 на рабочего (левая, правая,
+     * верхняя, нижняя) */
+    char **band;
+    /** @brief семафоры границ (нумерация как у band) */
+    struct fsem *sem;
+};
+
+/**
+ * Тело рабочего-потока: инициализация, цикл выполнения команд сервера
+ * до O_QUIT и освобождение памяти.
+ *
+ * @param[in] arg параметры рабочего (struct worker_arg)
+ * @return NULL
+ */
+void *worker_thread(void *arg);
+
+#endif
@@ -6,6 +6,8 @@
  * заголовочном файле "life.h".
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,66 +27,72 @@
 #define O_ADD     1
 /** @brief очистить "вселенную" */
 #define O_CLEAR   2
-/** @brief начать процесс моделирования */
+/** @brief начать процесс моделирования: prm1 поколений, а при prm1 = 0
+ * — до команды O_STOP. Рабочим сервер передает в prm1 число поколений
+ * пакета, а в prm2 — 1, если после пакета нужен хеш блока (для поиска
+ * циклов) */
 #define O_START   3
 /** @brief остановить процесс моделирования */
 #define O_STOP    4
-/** @brief сделать скриншот текущего состояния "вселенной" */
+/** @brief сделать скриншот текущего состояния "вселенной" (prm2 клиента
+ * равен 1, если нужны только изменения с прошлого скриншота) */
 #define O_SNAP    5
 /** @brief удалить клетку из "вселенной"*/
 #define O_DEL     6
+/** @brief загрузить образец из файла (RLE, Life 1.06, plaintext)
+ *
+ * Клиент передает путь к файлу в содержимом сообщения и левый верхний угол образца в
+ * prm1, prm2. Рабочим сервер передает в prm1 идентификатор сегмента
+ * разделяемой памяти, в котором лежат K смещений, K длин и затем пары
+ * (строка, столбец) клеток в локальных координатах блоков.
+ */
+#define O_LOAD    7
+/** @brief сохранить контрольную точку в файл (путь в содержимом) */
+#define O_SAVE    8
+/** @brief восстановить "вселенную" из контрольной точки (путь в
+ * содержимом) */
+#define O_RESTORE 9
+/** @brief перебалансировка, шаг 1: освободить карты и границы */
+#define O_DETACH 10
+/** @brief перебалансировка, шаг 2: занять блок по новым границам и
+ * заполнить его из буфера кадра prm1 */
+#define O_ATTACH 11
+/** @brief дождаться окончания моделирования */
+#define O_WAIT   12
+/** @brief собрать счетчики этапов: рабочие подсчитывают живые клетки,
+ * клиент читает счетчики из управляющего сегмента (см. "life-stats.h") */
+#define O_STATS  13
+/** @brief сменить правило: клиент передает запись B/S в содержимом, рабочим
+ * сервер передает маски рождения и выживания в prm1 и prm2 */
+#define O_RULE   14
+/** @brief заполнить блок из буфера кадра prm1 (поколения, построенные
+ * сервером в режиме HashLife, см. "life-hash.h") */
+#define O_FILL   15
+/** @brief первый этап поколения разреженной "вселенной": выделить и
+ * освободить чанки (см. "life-chunk.h") */
+#define O_GROW   16
+/** @brief записать изменения полосы строк между задним буфером кадра
+ * prm1 и передним (см. "life-fb.h") */
+#define O_DELTA  17
+/** @brief записывать кадр каждые prm1 поколений в файл или канал (путь в
+ * содержимом, см. "life-stream.h"); prm1 = 0 — прекратить запись */
+#define O_STREAM 18
 /** @brief завершить работу */
-#define O_QUIT   13
+#define O_QUIT   19
+/** @brief добавить и удалить пачку клеток: в содержимом prm1 записей
+ * struct msg_cell, в ответе — по строке на клетку (см. "life-msg.h") */
+#define O_CELLS  20
 
-/** @brief длина текстового сообщения */
+/** @brief длина строки лога и пути к файлу */
 #define STRSIZE 4096
 
-/**
- * @brief сообщение
- *
- * Сообщения используются для обмена данными между
- *   -# клиентом и сервером;
- *   -# сервером и рабочими.
- */
-struct msg_ {
-    /** @brief тип сообщения
-     * 
-     * Это поле может быть равно:
-     *   - pid_client,
-     *   - pid_server,
-     *   - pid_worker[i],
-     *   - worker_being_ready.
-     * */
-    long mtype;
-    /** @brief тип команды (операция)
-     * 
-     * Это поле может быть равно:
-     *   - O_ADD
-     *   - O_CLEAR
-     *   - O_START
-     *   - O_STOP
-     *   - O_SNAP
-     *   - M_ATTACH
-     *   - O_DEL
-     *   - O_QUIT
-     * либо просто использоваться для передачи информации.
-     * */
-    int op;
-    /** @brief первый параметр операции */
-    int prm1;
-    /** @brief второй параметр операции */
-    int prm2;
-    /** @brief текстовое содержание сообщения */
-    char mtext[STRSIZE];
-} message;
-
 /**
  * Записать сообщение в лог-файл.
  *
  * @param[in] f лог-файл
  * @param[in] msg текстовое сообщение
  */
-void write_log(FILE *f, char msg[]) {
+static inline void write_log(FILE *f, char msg[]) {
     char       buffer[STRSIZE];
     time_t     curtime;
     struct tm *loctime;
@@ -95,18 +103,25 @@ void write_log(FILE *f, char msg[]) {
     fprintf(f, "%s %s\n", buffer, msg);
 }
 
+/**
+ * Найти начало i-й из parts частей отрезка из n клеток при равномерном
+ * разбиении (части отличаются по длине не более чем на единицу).
+ *
+ * @param[in] n длина отрезка
+ * @param[in] parts число частей
+ * @param[in] i номер части (0..parts; для parts возвращается n)
+ * @return номер первой клетки части, считая с нуля
+ */
+static inline int life_split(int n, int parts, int i) {
+    return (int) ((long long) i * n / parts);
+}
+
 /**
  * Сообщить об аварийном завершении работы и завершить работу.
  *
  * @param[in] str текстовое сообщение
  */
-void quit_message(char str[]) {
+static inline void quit_message(char str[]) {
     printf("%s\n", str);
     exit(1);
 }
-
-/** @brief тип сообщения
- * 
- * Данный тип сообщений используется для подтверждения рабочим того, что
- * он выполнил команду, посланную сервером.*/
-#define worker_being_ready 15